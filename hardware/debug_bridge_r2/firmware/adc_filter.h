@@ -0,0 +1,67 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+/// @file adc_filter.h
+/// Oversample-and-decimate stage between the raw conversions and the sample
+/// queue. Shared by the ADC interrupt and the host simulation, so replayed
+/// traces see the same filtering as the board.
+
+#ifndef _ADC_FILTER_H
+#define _ADC_FILTER_H 1
+
+#include "hardware.h"
+
+#include <stdbool.h>
+#include <inttypes.h>
+
+#if ADC_OVERSAMPLE_BITS < 0 || ADC_OVERSAMPLE_BITS > 3
+#error "ADC_OVERSAMPLE_BITS must be 0..3 to fit the 16-bit accumulators"
+#endif
+
+/// Per-channel accumulators for one pair of channels.
+struct adc_decimator {
+    uint16_t sum_pixc;
+    uint16_t sum_dbg;
+};
+
+/// Add one raw conversion, shifted left by weight. A channel converted fewer
+/// than ADC_OVERSAMPLE_COUNT times in a sample is weighted up to make the
+/// count (see adc_plan.h).
+static inline void adc_accumulate(struct adc_decimator *d, bool dbg, uint16_t value,
+                                  uint8_t weight)
+{
+    if (dbg)
+        d->sum_dbg += value << weight;
+    else
+        d->sum_pixc += value << weight;
+}
+
+/// Store the decimated ADC_BITS-wide values of a completed sample and reset.
+static inline void adc_decimate(struct adc_decimator *d, uint16_t *out_pixc, uint16_t *out_dbg)
+{
+    *out_pixc = d->sum_pixc >> ADC_DECIMATE_SHIFT;
+    *out_dbg  = d->sum_dbg  >> ADC_DECIMATE_SHIFT;
+    d->sum_pixc = 0;
+    d->sum_dbg = 0;
+}
+
+#endif // _ADC_FILTER_H
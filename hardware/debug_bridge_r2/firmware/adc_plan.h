@@ -0,0 +1,119 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+/// @file adc_plan.h
+/// Conversion sequence of the ADC interrupt. Shared by the interrupt and the
+/// host simulation, so replayed traces see the same sampling as the board.
+///
+/// Conversions fall on a grid of slots, 1/ADC_CONVERSION_HZ apart. Each
+/// filtered sample pair comes from one frame of ADC_FRAME_SLOTS slots: even
+/// slots convert PixC vbus and odd slots debug vbus. The plan decides which
+/// slots actually convert. Balanced uses all of them. A critical-channel plan
+/// uses every slot of that channel but only the first of the other, whose one
+/// conversion is weighted to stand in for ADC_OVERSAMPLE_COUNT of them. In the
+/// low-rate scan the frame is ADC_SCAN_FACTOR times as long, the extra slots
+/// idle. Unused slots trigger no conversion and no interrupt at all.
+
+#ifndef _ADC_PLAN_H
+#define _ADC_PLAN_H 1
+
+#include "hardware.h"
+
+#include <stdbool.h>
+#include <inttypes.h>
+
+#define ADC_FRAME_SLOTS         (2u * ADC_OVERSAMPLE_COUNT)
+#define ADC_SCAN_SLOTS          (ADC_FRAME_SLOTS * ADC_SCAN_FACTOR)
+
+#if ADC_SCAN_FACTOR < 1 || ADC_SCAN_SLOTS > 255
+#error "ADC_SCAN_FACTOR out of range"
+#endif
+
+/// Flag or'ed into a plan for the low-rate scan
+#define ADC_PLAN_SCAN           0x80u
+
+/// Position in the sequence
+struct adc_sequencer {
+    uint8_t plan;       ///< Plan of the current frame, maybe with ADC_PLAN_SCAN
+    uint8_t slot;       ///< Slot of the conversion in progress
+};
+
+
+/// Return whether a slot converts under a plan.
+static inline bool adc_plan_converts(uint8_t plan, uint8_t slot)
+{
+    switch (plan & ~ADC_PLAN_SCAN) {
+    case ADC_PLAN_PIXC:
+        return !(slot & 1u) || slot == 1u;
+    case ADC_PLAN_DBG:
+        return (slot & 1u) || slot == 0u;
+    default:
+        return true;
+    }
+}
+
+
+/// Return the left shift weighting one conversion of a channel under a plan.
+static inline uint8_t adc_plan_weight(uint8_t plan, bool dbg)
+{
+    switch (plan & ~ADC_PLAN_SCAN) {
+    case ADC_PLAN_PIXC:
+        return dbg ? 2u * ADC_OVERSAMPLE_BITS : 0u;
+    case ADC_PLAN_DBG:
+        return dbg ? 0u : 2u * ADC_OVERSAMPLE_BITS;
+    default:
+        return 0u;
+    }
+}
+
+
+/// Return whether the conversion in progress is of debug vbus.
+static inline bool adc_sequencer_dbg(const struct adc_sequencer *s)
+{
+    return s->slot & 1u;
+}
+
+
+/// Move on from the conversion in progress to the next one.
+/// @param gap - receives the number of slots until it
+/// @return true if that ended the frame; the next conversion is then slot 0
+///         of a new frame, and the caller may change s->plan for it.
+static inline bool adc_sequencer_next(struct adc_sequencer *s, uint8_t *gap)
+{
+    uint8_t slot = s->slot + 1u;
+
+    // Outside balanced, every other slot is the critical channel's
+    if (slot < ADC_FRAME_SLOTS && !adc_plan_converts(s->plan, slot))
+        ++slot;
+
+    if (slot < ADC_FRAME_SLOTS) {
+        *gap = slot - s->slot;
+        s->slot = slot;
+        return false;
+    }
+
+    *gap = ((s->plan & ADC_PLAN_SCAN) ? ADC_SCAN_SLOTS : ADC_FRAME_SLOTS) - s->slot;
+    s->slot = 0;
+    return true;
+}
+
+#endif // _ADC_PLAN_H
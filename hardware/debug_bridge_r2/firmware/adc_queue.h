@@ -0,0 +1,118 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+/// @file adc_queue.h
+/// Single-producer, single-consumer queue of filtered sample pairs, from the
+/// ADC interrupt to the main loop, each tagged with its bridge channel. Shared
+/// by the ADC interrupt and the host simulation.
+///
+/// No locking: the producer only writes head and the consumer only writes
+/// tail, both single bytes, and each side publishes its index only after the
+/// entry is written or read. A push into a full queue drops the new pair and
+/// counts it in overflows, which saturates rather than wrapping to zero.
+///
+/// With a single bridge channel the tag is not stored; pops return channel 0.
+
+#ifndef _ADC_QUEUE_H
+#define _ADC_QUEUE_H 1
+
+#include <stdbool.h>
+#include <inttypes.h>
+#include "hardware.h"
+
+/// Number of entries; a power of two, at most 128. At 500 filtered pairs per
+/// second, 8 entries cover 16 ms of main loop delay, whatever the channels,
+/// well over the longest task, a dump line (see diag_task() in main.c).
+/// STATS, TWI and multi-bridge builds halve the queue for RAM, which still
+/// covers 8 ms.
+#ifndef ADC_QUEUE_LEN
+#define ADC_QUEUE_LEN   8u
+#endif
+
+#if (ADC_QUEUE_LEN & (ADC_QUEUE_LEN - 1u)) || ADC_QUEUE_LEN > 128u
+#error "ADC_QUEUE_LEN must be a power of two, at most 128"
+#endif
+
+#define ADC_QUEUE_MASK  (ADC_QUEUE_LEN - 1u)
+
+struct adc_queue {
+    volatile uint16_t pixc[ADC_QUEUE_LEN];
+    volatile uint16_t dbg[ADC_QUEUE_LEN];
+#if BRIDGE_COUNT > 1
+    volatile uint8_t ch[ADC_QUEUE_LEN];
+#endif
+    volatile uint8_t head;          ///< Free-running write count, producer only
+    volatile uint8_t tail;          ///< Free-running read count, consumer only
+    volatile uint8_t overflows;     ///< Pairs dropped on a full queue, producer only
+};
+
+
+/// Producer side. Add a pair, or count it as dropped if the queue is full.
+static inline void adc_queue_push(struct adc_queue *q, uint8_t ch, uint16_t pixc, uint16_t dbg)
+{
+    uint8_t head = q->head;
+
+    if ((uint8_t)(head - q->tail) >= ADC_QUEUE_LEN) {
+        if (q->overflows != 0xff)
+            ++q->overflows;
+        return;
+    }
+
+    q->pixc[head & ADC_QUEUE_MASK] = pixc;
+    q->dbg[head & ADC_QUEUE_MASK] = dbg;
+#if BRIDGE_COUNT > 1
+    q->ch[head & ADC_QUEUE_MASK] = ch;
+#else
+    (void) ch;
+#endif
+    q->head = head + 1u;
+}
+
+
+/// Consumer side. Take the oldest pair and return true, or return false if
+/// the queue is empty.
+static inline bool adc_queue_pop(struct adc_queue *q, uint8_t *ch, uint16_t *pixc, uint16_t *dbg)
+{
+    uint8_t tail = q->tail;
+
+    if (tail == q->head)
+        return false;
+
+    *pixc = q->pixc[tail & ADC_QUEUE_MASK];
+    *dbg = q->dbg[tail & ADC_QUEUE_MASK];
+#if BRIDGE_COUNT > 1
+    *ch = q->ch[tail & ADC_QUEUE_MASK];
+#else
+    *ch = 0;
+#endif
+    q->tail = tail + 1u;
+    return true;
+}
+
+
+/// Return whether the queue holds any pairs. Safe from either side.
+static inline bool adc_queue_pending(const struct adc_queue *q)
+{
+    return q->tail != q->head;
+}
+
+#endif // _ADC_QUEUE_H
@@ -0,0 +1,85 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "config.h"
+#include "hardware.h"
+
+#include <avr/eeprom.h>
+
+#define EEPROM_CONFIG   ((const void *) 0)
+
+struct config config = {
+    .thresholds = VBUS_THRESHOLDS_DEFAULT,
+    .debounce_attach = ADC_MS_TO_SAMPLES(DEBOUNCE_ATTACH_MS),
+    .debounce_detach = ADC_MS_TO_SAMPLES(DEBOUNCE_DETACH_MS),
+    .hub_reset_role_swap_ms = HUB_RESET_MS_ROLE_SWAP,
+    .hub_reset_same_role_ms = HUB_RESET_MS_SAME_ROLE,
+    .hub_reset_to_none_ms = HUB_RESET_MS_TO_NONE,
+};
+
+
+#ifndef VBUS_LUT
+// Convert mV to a sample value, as ADC_VAL() does at compile time
+static uint16_t mv_to_sample(uint16_t mv)
+{
+    return ((uint32_t) mv << ADC_BITS) / 6600u;
+}
+#endif
+
+
+// ADC_MS_TO_SAMPLES() for a runtime value; the macro would overflow 16 bits.
+// ADC_SAMPLE_HZ need not be a multiple of 100 with several channels, so the
+// frame rate is used instead.
+static uint8_t ms_to_samples(uint8_t ms)
+{
+    uint8_t n = (uint16_t) ms * (ADC_FRAME_HZ / 100u) / (10u * BRIDGE_COUNT);
+
+    return n ? n : 1u;
+}
+
+
+bool config_load(void)
+{
+    struct config_block blk;
+
+    eeprom_read_block(&blk, EEPROM_CONFIG, sizeof blk);
+    if (!config_block_valid(&blk))
+        return false;
+
+#ifndef VBUS_LUT
+    config.thresholds = (struct vbus_thresholds) {
+        .valid_rise = mv_to_sample(blk.valid_rise_mv),
+        .valid_fall = mv_to_sample(blk.valid_fall_mv),
+        .diode_enter_min = mv_to_sample(blk.diode_enter_min_mv),
+        .diode_enter_max = mv_to_sample(blk.diode_enter_max_mv),
+        .diode_leave_min = mv_to_sample(blk.diode_leave_min_mv),
+        .diode_leave_max = mv_to_sample(blk.diode_leave_max_mv),
+    };
+#endif
+    config.debounce_attach = ms_to_samples(blk.debounce_attach_ms);
+    config.debounce_detach = ms_to_samples(blk.debounce_detach_ms);
+    config.hub_reset_role_swap_ms = blk.hub_reset_role_swap_ms;
+    config.hub_reset_same_role_ms = blk.hub_reset_same_role_ms;
+    config.hub_reset_to_none_ms = blk.hub_reset_to_none_ms;
+
+    return true;
+}
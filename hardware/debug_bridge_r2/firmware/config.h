@@ -0,0 +1,159 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+/// @file config.h
+/// Runtime configuration: vbus thresholds, debounce and hub reset timing.
+///
+/// config_load() fills `config` at startup from a block at the start of the
+/// EEPROM, or from the compiled-in defaults if the block is missing, of another
+/// version or layout, fails its CRC, or holds inconsistent values. The block is
+/// in board units (mV and ms), so one image suits any build; config_load()
+/// converts it to sample units. The VBUS_LUT build keeps its compiled-in
+/// thresholds and only takes the timing from the block.
+///
+/// The block is written in-system over ISP: `make config.eep` builds an image
+/// with sim/gen_config, `make program-config` writes it with avrdude. The
+/// EESAVE fuse keeps it across firmware updates.
+
+#ifndef _CONFIG_H
+#define _CONFIG_H 1
+
+#include "vbus_classify.h"
+
+#include <util/crc16.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+// How long a new mode must be seen continuously before it is committed, in ms.
+// A mode with more powered rails than the current one is an attach and commits
+// quickly; anything else is a detach and waits longer, since dropping a rail
+// too early costs a needless role swap. Samples are already averaged over
+// ADC_OVERSAMPLE_COUNT conversion pairs, so a short window is enough.
+#define DEBOUNCE_ATTACH_MS  4u
+#define DEBOUNCE_DETACH_MS  10u
+
+// Hub reset pulse lengths in ms, by kind of mode change (see the policy table
+// in policy.c). A duration of zero skips the reset for that kind of change.
+#define HUB_RESET_MS_ROLE_SWAP  500u    ///< PixC switches between host and device
+#define HUB_RESET_MS_SAME_ROLE  500u    ///< Mode changed, PixC keeps its role
+#define HUB_RESET_MS_TO_NONE    500u    ///< All vbus lost
+
+/// Configuration block layout version; bump on any change to config_block
+#define CONFIG_VERSION      1u
+
+/// Configuration block, as stored at EEPROM address 0. Little-endian, no padding.
+struct config_block {
+    uint8_t version;                ///< CONFIG_VERSION
+    uint8_t size;                   ///< sizeof(struct config_block)
+    uint16_t valid_rise_mv;
+    uint16_t valid_fall_mv;
+    uint16_t diode_enter_min_mv;
+    uint16_t diode_enter_max_mv;
+    uint16_t diode_leave_min_mv;
+    uint16_t diode_leave_max_mv;
+    uint8_t debounce_attach_ms;
+    uint8_t debounce_detach_ms;
+    uint16_t hub_reset_role_swap_ms;
+    uint16_t hub_reset_same_role_ms;
+    uint16_t hub_reset_to_none_ms;
+    uint16_t crc;                   ///< CRC-16 (0xa001, init 0xffff) of the bytes before it
+};
+
+_Static_assert(sizeof(struct config_block) == 24, "config_block must not be padded");
+
+/// Configuration in effect
+struct config {
+    struct vbus_thresholds thresholds;
+    uint8_t debounce_attach;        ///< samples
+    uint8_t debounce_detach;        ///< samples
+    uint16_t hub_reset_role_swap_ms;
+    uint16_t hub_reset_same_role_ms;
+    uint16_t hub_reset_to_none_ms;
+};
+
+extern struct config config;
+
+/// Load the configuration from EEPROM, falling back to the defaults.
+/// @return whether the EEPROM block was used
+bool config_load(void);
+
+// Block helpers, shared with the host tool sim/gen_config
+
+#define CONFIG_MV(volts)    ((uint16_t)((volts) * 1000.0 + 0.5))
+
+/// Compute the CRC of a block, over everything before the crc field.
+static inline uint16_t config_block_crc(const struct config_block *blk)
+{
+    const uint8_t *p = (const uint8_t *) blk;
+    uint16_t crc = 0xffff;
+
+    for (uint8_t i = 0; i < offsetof(struct config_block, crc); ++i)
+        crc = _crc16_update(crc, p[i]);
+
+    return crc;
+}
+
+
+/// Fill a block with the compiled-in defaults, including its CRC.
+static inline void config_block_defaults(struct config_block *blk)
+{
+    *blk = (struct config_block) {
+        .version = CONFIG_VERSION,
+        .size = sizeof(struct config_block),
+        .valid_rise_mv = CONFIG_MV(VBUS_VALID_RISE_V),
+        .valid_fall_mv = CONFIG_MV(VBUS_VALID_FALL_V),
+        .diode_enter_min_mv = CONFIG_MV(DIODE_ENTER_MIN_V),
+        .diode_enter_max_mv = CONFIG_MV(DIODE_ENTER_MAX_V),
+        .diode_leave_min_mv = CONFIG_MV(DIODE_LEAVE_MIN_V),
+        .diode_leave_max_mv = CONFIG_MV(DIODE_LEAVE_MAX_V),
+        .debounce_attach_ms = DEBOUNCE_ATTACH_MS,
+        .debounce_detach_ms = DEBOUNCE_DETACH_MS,
+        .hub_reset_role_swap_ms = HUB_RESET_MS_ROLE_SWAP,
+        .hub_reset_same_role_ms = HUB_RESET_MS_SAME_ROLE,
+        .hub_reset_to_none_ms = HUB_RESET_MS_TO_NONE,
+    };
+    blk->crc = config_block_crc(blk);
+}
+
+
+/// Check a block's header, CRC and values.
+static inline bool config_block_valid(const struct config_block *blk)
+{
+    if (blk->version != CONFIG_VERSION || blk->size != sizeof(struct config_block))
+        return false;
+    if (blk->crc != config_block_crc(blk))
+        return false;
+
+    // Hysteresis must not be inverted, and the LEAVE window must contain the
+    // ENTER window, or the classifier could flip state on a steady input.
+    // Everything must also be within the ADC's 6.6 V range.
+    return blk->valid_fall_mv <= blk->valid_rise_mv &&
+           blk->valid_rise_mv < 6600u &&
+           blk->diode_leave_min_mv <= blk->diode_enter_min_mv &&
+           blk->diode_enter_min_mv <= blk->diode_enter_max_mv &&
+           blk->diode_enter_max_mv <= blk->diode_leave_max_mv &&
+           blk->diode_leave_max_mv < 6600u &&
+           blk->debounce_attach_ms && blk->debounce_detach_ms;
+}
+
+#endif // _CONFIG_H
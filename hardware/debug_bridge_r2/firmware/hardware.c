@@ -21,10 +21,43 @@
 // WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include "hardware.h"
+#include "adc_filter.h"
+#include "adc_plan.h"
+#include "adc_queue.h"
+#include "trip.h"
 #include "pin_io.h"
+#include "twi_target.h"
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
 #include <util/atomic.h>
 #include <stdlib.h>
+#include <string.h>
+
+// Default state of one bridge channel's pins, with suffix s (see BRIDGE_PINS):
+// no LEDs, mux in non-debug, charging off, hubs held in reset with no vbus
+// detect, sense inputs and CC pins floating.
+#define INIT_CHANNEL(s) do { \
+    PINPUT(LED_A##s); \
+    PINPUT(LED_B##s); \
+    PLOW(USBMUX##s); \
+    POUTPUT(USBMUX##s); \
+    PLOW(DBG_PWR##s); \
+    POUTPUT(DBG_PWR##s); \
+    PLOW(HUBnRST##s); \
+    PLOW(VBUSDET1##s); \
+    PLOW(VBUSDET2##s); \
+    POUTPUT(HUBnRST##s); \
+    POUTPUT(VBUSDET1##s); \
+    POUTPUT(VBUSDET2##s); \
+    PINPUT(VBUS_PIXC_SENSE##s); \
+    PINPUT(VBUS_DBG_SENSE##s); \
+    PINPUT(CC1PD##s); \
+    PINPUT(CC2PD##s); \
+    PINPUT(CC1PU##s); \
+    PINPUT(CC2PU##s); \
+} while (0);
+
 
 void init_ports(void)
 {
@@ -35,43 +68,44 @@ void init_ports(void)
     PORTC = 0;
     PORTD = 0;
 
-    // No LEDs by default
-    PINPUT(LED_A);
-    PINPUT(LED_B);
-
-    // Mux in non-debug by default
-    PLOW(USBMUX);
-    POUTPUT(USBMUX);
+    BRIDGE_PINS(INIT_CHANNEL)
 
-    // Charging power off by default
-    PLOW(DBG_PWR);
-    POUTPUT(DBG_PWR);
+    // Trace dump port: TX idles high, request input has a pull-up
+    PHIGH(TRACE_TX);
+    POUTPUT(TRACE_TX);
+    PHIGH(TRACE_REQ);
+    PINPUT(TRACE_REQ);
 
-    // Hubs held in reset
-    PLOW(HUBnRST);
-    PLOW(VBUSDET1);
-    PLOW(VBUSDET2);
-    POUTPUT(HUBnRST);
-    POUTPUT(VBUSDET1);
-    POUTPUT(VBUSDET2);
+    if (MARKERS) {
+        PLOW(MARKER);
+        POUTPUT(MARKER);
+    }
+}
 
-    // Analog inputs
-    PINPUT(VBUS_PIXC_SENSE);
-    PINPUT(VBUS_DBG_SENSE);
 
-    // USB-C CC pins
-    PINPUT(CC1PD);
-    PINPUT(CC2PD);
-    PINPUT(CC1PU);
-    PINPUT(CC2PU);
+void init_power(void)
+{
+    // The SPI is not used: the ISP header pins are driven as GPIO. Nor is the
+    // TWI, outside TWI_TARGET builds. Timer1 stays on, it paces the ADC.
+#ifdef TWI_TARGET
+    PRR = (1 << PRSPI);
+#else
+    PRR = (1 << PRTWI) | (1 << PRSPI);
+#endif
 }
 
 
+// Waveform mode = CTC (clear timer on compare match). Prescaler = 64 at the
+// full clock and 8 at the slow one: ftimer = 125 kHz either way.
+#define TCCR0A_FULL     ((1 << CTC0) | (1 << CS01) | (1 << CS00))
+#define TCCR0A_SLOW     ((1 << CTC0) | (1 << CS01))
+
+_Static_assert(CLOCK_SLOW_SHIFT == 3, "Timer0 and ADC prescalers are only worked out for F_CPU / 8");
+
+
 void init_tick_timer(void)
 {
-    // Waveform mode = CTC (clear timer on compare match)
-    // Prescaler = 64, fcpu = 8 MHz gives ftimer = 125 kHz
-    TCCR0A = (1 << CTC0) | (1 << CS01) | (1 << CS00);
+    TCCR0A = TCCR0A_FULL;
     // Count to 124 gives 125 kHz / 125 = 1 kHz overflows
     OCR0A = 124;
     // Interrupt on compare match
@@ -97,187 +131,725 @@ uint16_t get_ticks(void)
 }
 
 
-void set_leds_host(void)
+uint16_t get_stamp(void)
 {
-    PHIGH(LED_A);
-    PLOW(LED_B);
-    POUTPUT(LED_A);
-    POUTPUT(LED_B);
+    uint16_t t;
+    uint8_t count;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        t = ticks;
+        count = TCNT0;
+        // The counter cleared but the tick interrupt has not run yet
+        if ((TIFR0 & (1 << OCF0A)) && count < OCR0A / 2u)
+            ++t;
+    }
+
+    // 125 counts of 8 us per tick; spelled out, as there is no multiplier
+    return (t << 7) - (t << 2) + t + count;
 }
 
 
-void set_leds_dev(void)
+void sleep_until_interrupt(void)
 {
-    PLOW(LED_A);
-    PHIGH(LED_B);
-    POUTPUT(LED_A);
-    POUTPUT(LED_B);
+    // Idle keeps clkIO running, so TIMER0 keeps ticking and the ADC keeps
+    // converting. ADC noise reduction mode would stop the tick timer.
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
 }
 
 
-void set_leds_off(void)
+// Pins owned by set_outputs(), for the channel with pin suffix s. HUBnRST is
+// not among them: the hub reset is timed separately and a mode change must
+// not disturb it.
+#define IMG_PINS(s, i)  (PBIT(LED_A##s, i) | PBIT(LED_B##s, i) | PBIT(USBMUX##s, i) | \
+                         PBIT(DBG_PWR##s, i) | PBIT(VBUSDET1##s, i) | PBIT(VBUSDET2##s, i) | \
+                         PBIT(CC1PD##s, i) | PBIT(CC2PD##s, i) | PBIT(CC1PU##s, i) | PBIT(CC2PU##s, i))
+
+// For each configuration, the owned pins that are driven (DDR image) and those
+// of them driven high (PORT image). Undriven pins float with no pull-up.
+#define IDLE_DRIVE(s, i) (PBIT(USBMUX##s, i) | PBIT(DBG_PWR##s, i) | PBIT(VBUSDET1##s, i) | \
+                          PBIT(VBUSDET2##s, i) | PBIT(CC1PD##s, i))
+#define IDLE_HIGH(s, i)  (PBIT(VBUSDET1##s, i))
+
+#define HOST_DRIVE(s, i) (IDLE_DRIVE(s, i) | PBIT(LED_A##s, i) | PBIT(LED_B##s, i))
+#define HOST_HIGH(s, i)  (IDLE_HIGH(s, i) | PBIT(LED_A##s, i))
+
+#define DEV_DRIVE(s, i)  (HOST_DRIVE(s, i) | PBIT(CC2PD##s, i))
+#define DEV_HIGH(s, i)   (PBIT(LED_B##s, i) | PBIT(DBG_PWR##s, i) | PBIT(USBMUX##s, i) | \
+                          PBIT(VBUSDET2##s, i))
+
+#define OFF_DRIVE(s, i)  (PBIT(USBMUX##s, i) | PBIT(DBG_PWR##s, i) | PBIT(VBUSDET1##s, i) | \
+                          PBIT(VBUSDET2##s, i))
+#define OFF_HIGH(s, i)   0u
+
+// Owned pins by group, see OUTPUT_*
+#define GRP_CHARGE(s, i)  PBIT(DBG_PWR##s, i)
+#define GRP_VBUSDET(s, i) (PBIT(VBUSDET1##s, i) | PBIT(VBUSDET2##s, i))
+#define GRP_CC(s, i)      (PBIT(CC1PD##s, i) | PBIT(CC2PD##s, i) | PBIT(CC1PU##s, i) | \
+                           PBIT(CC2PU##s, i))
+#define GRP_MUX(s, i)     (PBIT(USBMUX##s, i) | PBIT(LED_A##s, i) | PBIT(LED_B##s, i))
+
+struct port_image {
+    uint8_t port[3];    ///< PORTB, PORTC, PORTD
+    uint8_t ddr[3];     ///< DDRB, DDRC, DDRD
+};
+
+#define PORT_IMAGE(cfg, s) { \
+    .port = { cfg##_HIGH(s, 0),  cfg##_HIGH(s, 1),  cfg##_HIGH(s, 2) }, \
+    .ddr  = { cfg##_DRIVE(s, 0), cfg##_DRIVE(s, 1), cfg##_DRIVE(s, 2) }, \
+}
+
+#define IMAGE_VALID(cfg, s, i) \
+    ((cfg##_HIGH(s, i) & ~cfg##_DRIVE(s, i)) == 0 && (cfg##_DRIVE(s, i) & ~IMG_PINS(s, i)) == 0)
+
+#define GRP_ALL(s, i)   (GRP_CHARGE(s, i) | GRP_VBUSDET(s, i) | GRP_CC(s, i) | GRP_MUX(s, i))
+
+#define CHANNEL_VALID(s) \
+    && IMAGE_VALID(IDLE, s, 0) && IMAGE_VALID(IDLE, s, 1) && IMAGE_VALID(IDLE, s, 2) \
+    && IMAGE_VALID(HOST, s, 0) && IMAGE_VALID(HOST, s, 1) && IMAGE_VALID(HOST, s, 2) \
+    && IMAGE_VALID(DEV, s, 0)  && IMAGE_VALID(DEV, s, 1)  && IMAGE_VALID(DEV, s, 2) \
+    && IMAGE_VALID(OFF, s, 0)  && IMAGE_VALID(OFF, s, 1)  && IMAGE_VALID(OFF, s, 2)
+
+#define CHANNEL_GROUPS(s) \
+    && GRP_ALL(s, 0) == IMG_PINS(s, 0) && GRP_ALL(s, 1) == IMG_PINS(s, 1) && \
+    GRP_ALL(s, 2) == IMG_PINS(s, 2)
+
+#define CHANNEL_ONE(s)  + 1
+
+_Static_assert(1 BRIDGE_PINS(CHANNEL_VALID),
+               "output images may only drive high pins they own and drive");
+_Static_assert(1 BRIDGE_PINS(CHANNEL_GROUPS), "output groups must cover exactly the owned pins");
+_Static_assert((0 BRIDGE_PINS(CHANNEL_ONE)) == BRIDGE_COUNT, "BRIDGE_PINS must list BRIDGE_COUNT channels");
+
+#define CHANNEL_IMAGES(s) { \
+    [OUTPUTS_IDLE] = PORT_IMAGE(IDLE, s), \
+    [OUTPUTS_HOST] = PORT_IMAGE(HOST, s), \
+    [OUTPUTS_DEV]  = PORT_IMAGE(DEV, s), \
+    [OUTPUTS_OFF]  = PORT_IMAGE(OFF, s), \
+},
+
+static const struct port_image output_images[BRIDGE_COUNT][OUTPUTS_OFF + 1] PROGMEM = {
+    BRIDGE_PINS(CHANNEL_IMAGES)
+};
+
+// Pins of each group, in OUTPUT_* bit order, for PORTB, PORTC and PORTD
+#define CHANNEL_GROUP_PINS(s) { \
+    { GRP_CHARGE(s, 0),  GRP_CHARGE(s, 1),  GRP_CHARGE(s, 2) }, \
+    { GRP_VBUSDET(s, 0), GRP_VBUSDET(s, 1), GRP_VBUSDET(s, 2) }, \
+    { GRP_CC(s, 0),      GRP_CC(s, 1),      GRP_CC(s, 2) }, \
+    { GRP_MUX(s, 0),     GRP_MUX(s, 1),     GRP_MUX(s, 2) }, \
+},
+
+#define OUTPUT_GROUP_COUNT  4u
+
+static const uint8_t group_pins[BRIDGE_COUNT][OUTPUT_GROUP_COUNT][3] PROGMEM = {
+    BRIDGE_PINS(CHANNEL_GROUP_PINS)
+};
+
+// What the ADC interrupt and the hub reset need of each channel. In flash,
+// read through BRIDGE_BYTE() and BRIDGE_PORT(): an lpm per field costs the
+// interrupt a few cycles, against 12 bytes of RAM per channel.
+struct bridge_pins {
+    volatile uint8_t *dbg_pwr_port;
+    volatile uint8_t *hub_rst_port;
+    uint8_t dbg_pwr_bit;
+    uint8_t hub_rst_bit;
+    uint8_t dbg_pwr_idx;    ///< Port index of DBG_PWR, in a port_image
+    uint8_t mux_pixc;
+    uint8_t mux_dbg;
+    uint8_t img_pins[3];    ///< IMG_PINS, for PORTB, PORTC and PORTD
+};
+
+#define CHANNEL_PINS(s) { \
+    .dbg_pwr_port = &_PORT_FOR_PIN(DBG_PWR##s), \
+    .hub_rst_port = &_PORT_FOR_PIN(HUBnRST##s), \
+    .dbg_pwr_bit = 1 << _NUM_FOR_PIN(DBG_PWR##s), \
+    .hub_rst_bit = 1 << _NUM_FOR_PIN(HUBnRST##s), \
+    .dbg_pwr_idx = PORTIDX(DBG_PWR##s), \
+    .mux_pixc = MUX_VBUS_PIXC_SENSE##s, \
+    .mux_dbg = MUX_VBUS_DBG_SENSE##s, \
+    .img_pins = { IMG_PINS(s, 0), IMG_PINS(s, 1), IMG_PINS(s, 2) }, \
+},
+
+static const struct bridge_pins bridges[BRIDGE_COUNT] PROGMEM = {
+    BRIDGE_PINS(CHANNEL_PINS)
+};
+
+#define BRIDGE_BYTE(ch, field)  pgm_read_byte(&bridges[BRIDGE_CH(ch)].field)
+#define BRIDGE_PORT(ch, field)  ((volatile uint8_t *) pgm_read_ptr(&bridges[BRIDGE_CH(ch)].field))
+
+
+// Latched by the ADC interrupt's fast trip, see trip.h. Zero is TRIP_NONE.
+static volatile uint8_t charge_fault[BRIDGE_COUNT];
+// Configuration last written to each charging switch, for clear_charge_fault().
+// Zero is OUTPUTS_IDLE.
+static uint8_t applied_outputs[BRIDGE_COUNT];
+
+
+// Write an image to a channel's pins in mask.
+static inline void write_image(uint8_t ch, struct port_image *img, const uint8_t *mask)
 {
-    PINPUT(LED_A);
-    PINPUT(LED_B);
+    uint8_t dbg_pwr_idx = BRIDGE_BYTE(ch, dbg_pwr_idx);
+    uint8_t dbg_pwr_bit = BRIDGE_BYTE(ch, dbg_pwr_bit);
+
+    // PORT before DDR: pins that stay outputs switch in the first three
+    // writes, pins becoming outputs then start driving their new level, and
+    // pins being released never see a pull-up since their PORT bit is clear.
+    // A latched charge fault keeps DBG_PWR low; it is checked in the same
+    // atomic block, so a trip cannot slip in between.
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (charge_fault[BRIDGE_CH(ch)] != TRIP_NONE)
+            img->port[dbg_pwr_idx] &= ~dbg_pwr_bit;
+
+        PORTB = (PORTB & ~mask[0]) | img->port[0];
+        PORTC = (PORTC & ~mask[1]) | img->port[1];
+        PORTD = (PORTD & ~mask[2]) | img->port[2];
+        DDRB  = (DDRB  & ~mask[0]) | img->ddr[0];
+        DDRC  = (DDRC  & ~mask[1]) | img->ddr[1];
+        DDRD  = (DDRD  & ~mask[2]) | img->ddr[2];
+    }
 }
 
 
-void set_charge_enabled(void)
+void set_outputs(uint8_t ch, enum output_config cfg)
 {
-    PHIGH(DBG_PWR);
+    struct port_image img;
+    uint8_t mask[3];
+
+    MARK_SPAN(MARK_OUTPUTS);
+
+    // Fetch the image before disabling interrupts to keep that window short.
+    memcpy_P(&img, &output_images[BRIDGE_CH(ch)][cfg], sizeof img);
+    memcpy_P(mask, bridges[BRIDGE_CH(ch)].img_pins, sizeof mask);
+    applied_outputs[BRIDGE_CH(ch)] = cfg;
+    write_image(ch, &img, mask);
+
+    MARK_SPAN(MARK_OUTPUTS);
 }
 
 
-void set_charge_disabled(void)
+void set_output_groups(uint8_t ch, enum output_config cfg, uint8_t groups)
 {
-    PLOW(DBG_PWR);
+    struct port_image img;
+    uint8_t mask[3] = {0, 0, 0};
+
+    MARK_SPAN(MARK_OUTPUTS);
+
+    memcpy_P(&img, &output_images[BRIDGE_CH(ch)][cfg], sizeof img);
+    for (uint8_t g = 0; g < OUTPUT_GROUP_COUNT; ++g) {
+        if (groups & (1u << g)) {
+            for (uint8_t i = 0; i < 3; ++i)
+                mask[i] |= pgm_read_byte(&group_pins[BRIDGE_CH(ch)][g][i]);
+        }
+    }
+    for (uint8_t i = 0; i < 3; ++i) {
+        img.port[i] &= mask[i];
+        img.ddr[i] &= mask[i];
+    }
+
+    if (groups & OUTPUT_CHARGE)
+        applied_outputs[BRIDGE_CH(ch)] = cfg;
+    write_image(ch, &img, mask);
+
+    MARK_SPAN(MARK_OUTPUTS);
 }
 
 
-bool is_charge_enabled(void)
+uint8_t get_output_changes(uint8_t ch, enum output_config from, enum output_config to)
 {
-    return PGETOUT(DBG_PWR);
+    struct port_image a, b;
+    uint8_t changes = 0;
+
+    memcpy_P(&a, &output_images[BRIDGE_CH(ch)][from], sizeof a);
+    memcpy_P(&b, &output_images[BRIDGE_CH(ch)][to], sizeof b);
+    for (uint8_t g = 0; g < OUTPUT_GROUP_COUNT; ++g) {
+        for (uint8_t i = 0; i < 3; ++i) {
+            uint8_t diff = (a.port[i] ^ b.port[i]) | (a.ddr[i] ^ b.ddr[i]);
+
+            if (diff & pgm_read_byte(&group_pins[BRIDGE_CH(ch)][g][i]))
+                changes |= 1u << g;
+        }
+    }
+    return changes;
 }
 
 
-void pull_cc1(enum CC_PULL_TYPE val)
+bool is_charge_enabled(uint8_t ch)
 {
-    switch(val) {
-    case CC_OPEN:
-        PLOW(CC1PD);
-        PLOW(CC1PU);
-        PINPUT(CC1PD);
-        PINPUT(CC1PU);
-        break;
-    case CC_DOWN:
-        PLOW(CC1PD);
-        PLOW(CC1PU);
-        POUTPUT(CC1PD);
-        PINPUT(CC1PU);
-        break;
-    case CC_UP:
-        PLOW(CC1PD);
-        PHIGH(CC1PU);
-        POUTPUT(CC1PU);
-        PINPUT(CC1PD);
-        break;
-    case CC_MID:
-        PLOW(CC1PD);
-        POUTPUT(CC1PD);
-        PHIGH(CC1PU);
-        POUTPUT(CC1PU);
-        break;
-    }
+    return *BRIDGE_PORT(ch, dbg_pwr_port) & BRIDGE_BYTE(ch, dbg_pwr_bit);
 }
 
 
-void pull_cc2(enum CC_PULL_TYPE val)
+void set_hub_reset(uint8_t ch, bool val)
 {
-    switch(val) {
-    case CC_OPEN:
-        PLOW(CC2PD);
-        PLOW(CC2PU);
-        PINPUT(CC2PD);
-        PINPUT(CC2PU);
-        break;
-    case CC_DOWN:
-        PLOW(CC2PD);
-        PLOW(CC2PU);
-        POUTPUT(CC2PD);
-        PINPUT(CC2PU);
-        break;
-    case CC_UP:
-        PLOW(CC2PD);
-        PHIGH(CC2PU);
-        POUTPUT(CC2PU);
-        PINPUT(CC2PD);
-        break;
-    case CC_MID:
-        PLOW(CC2PD);
-        POUTPUT(CC2PD);
-        PHIGH(CC2PU);
-        POUTPUT(CC2PU);
-        break;
+    volatile uint8_t *port = BRIDGE_PORT(ch, hub_rst_port);
+    uint8_t bit = BRIDGE_BYTE(ch, hub_rst_bit);
+
+    // The ADC interrupt writes the same ports to cut charging
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (val)
+            *port &= ~bit;
+        else
+            *port |= bit;
     }
+    MARK_EVENT(MARK_HUB_RESET);
 }
 
 
-void set_usb_mux_debug(void)
+void toggle_marker(void)
 {
-    PHIGH(USBMUX);
+    PTOGGLE(MARKER);
 }
 
 
-void set_usb_mux_normal(void)
+bool is_dump_requested(void)
 {
-    PLOW(USBMUX);
+    return !PGET(TRACE_REQ);
 }
 
 
-void set_hub_reset(bool val)
+// Cycles per bit, less the loop's own cost (about 8 cycles)
+#define DUMP_BIT_CYCLES (F_CPU / DUMP_BAUD - 8u)
+
+
+void dump_putc(char c)
 {
-    PVAL(HUBnRST, !val);
+    // Start bit, 8 data bits LSB first, stop bit
+    uint16_t frame = ((uint16_t)(uint8_t) c << 1) | (1u << 9);
+
+    // One character is under 90 us at 115200 baud, short enough that the ADC
+    // interrupt still switches the mux before the next conversion.
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        for (uint8_t i = 0; i < 10; ++i) {
+            PVAL(TRACE_TX, frame & 1u);
+            frame >>= 1;
+            __builtin_avr_delay_cycles(DUMP_BIT_CYCLES);
+        }
+    }
 }
 
 
-void set_hub1_vbus(bool val)
+#ifdef TWI_TARGET
+static struct twi_target twi;
+
+
+void init_twi(volatile uint8_t *regs, uint8_t size, uint8_t writable)
 {
-    PVAL(VBUSDET1, val);
+    twi.regs = regs;
+    twi.size = size;
+    twi.writable = writable;
+
+    // SDA and SCL need no setup: the TWI takes the pins over when enabled.
+    // The bus has its pull-ups on the host side.
+    TWAR = TWI_ADDRESS << 1;
+    TWCR = (1 << TWEA) | (1 << TWEN) | (1 << TWIE);
 }
 
 
-void set_hub2_vbus(bool val)
+bool is_twi_busy(void)
 {
-    PVAL(VBUSDET2, val);
+    return twi_target_busy(&twi);
 }
 
 
-static void (* volatile adc_callback)(uint16_t pixc, uint16_t dbg) = NULL;
+ISR(TWI_vect)
+{
+    uint8_t status = TWSR & TW_STATUS_MASK;
+    uint8_t data = TWDR;
+
+    if (twi_target_event(&twi, status, &data))
+        TWDR = data;
+
+    // Always acknowledge, so the target is addressable again once a
+    // transaction ends. On a bus error, release the lines.
+    TWCR = (1 << TWINT) | (1 << TWEA) | (1 << TWEN) | (1 << TWIE) |
+           ((status == TW_BUS_ERROR) ? (1 << TWSTO) : 0);
+}
+#endif
+
+
+// Filtered pairs, from the ADC interrupt to the main loop
+static struct adc_queue adc_queue;
+#ifdef STATS
+static volatile uint16_t adc_queue_stamp;
+#endif
+
+
+// Timer1 TOP for ADC_CONVERSION_HZ conversions per second
+#define ADC_TRIGGER_TOP (F_CPU / ADC_CONVERSION_HZ - 1u)
+
+// A conversion takes 13.5 ADC clocks after an auto trigger. Leave at least as
+// long again before the next trigger, so the ISR always switches the mux
+// before the next conversion samples it and channels cannot swap.
+#define ADC_CONVERSION_CYCLES (14u * 64u)
+
+_Static_assert(ADC_TRIGGER_TOP + 1u >= 2u * ADC_CONVERSION_CYCLES,
+               "ADC_CONVERSION_HZ too high for the ADC clock");
+_Static_assert(ADC_TRIGGER_TOP <= 0xffffu, "ADC_CONVERSION_HZ too low for Timer1");
+_Static_assert(ADC_SCAN_SLOTS * (ADC_TRIGGER_TOP + 1ul) <= 0x10000ul,
+               "low-rate scan frame too long for Timer1");
+
+// Timer1 TOP for one slot at the slow clock: ADC_SCAN_FACTOR full-speed slots
+// long, so a frame of stretched slots lasts as long as a scan frame.
+#define ADC_SLOW_TRIGGER_TOP \
+    ((ADC_TRIGGER_TOP + 1ul) * ADC_SCAN_FACTOR / (1u << CLOCK_SLOW_SHIFT) - 1u)
+#define ADC_SLOW_CONVERSION_CYCLES (14u * (64u >> CLOCK_SLOW_SHIFT))
+
+_Static_assert((ADC_TRIGGER_TOP + 1ul) * ADC_SCAN_FACTOR % (1u << CLOCK_SLOW_SHIFT) == 0,
+               "slow slot is not a whole number of cycles");
+_Static_assert(ADC_SLOW_TRIGGER_TOP + 1u >= 2u * ADC_SLOW_CONVERSION_CYCLES,
+               "ADC_SCAN_FACTOR too low for the slow clock");
+_Static_assert(ADC_FRAME_SLOTS * (ADC_SLOW_TRIGGER_TOP + 1ul) <= 0x10000ul,
+               "slow frame too long for Timer1");
+
+// ADC enabled, interrupting, auto-triggered. The ADC clock is 125 kHz at
+// either clock step, within the 50..200 kHz range: 8 MHz / 64 or 1 MHz / 8.
+#define ADCSRA_FULL     ((1 << ADEN) | (1 << ADIE) | (1 << ADATE) | (1 << ADPS2) | (1 << ADPS1))
+#define ADCSRA_SLOW     ((1 << ADEN) | (1 << ADIE) | (1 << ADATE) | (1 << ADPS1) | (1 << ADPS0))
+
+// Plan for each channel's next frame, with ADC_PLAN_SCAN; read by the ADC
+// interrupt. Zero is ADC_PLAN_BALANCED.
+static volatile uint8_t adc_plan_next[BRIDGE_COUNT];
+// Whether Timer1 is counting out the idle end of a scan frame
+static volatile bool adc_scan_idle = false;
+// Timer1 TOP for one slot at the clock step in effect
+static volatile uint16_t adc_slot_top = ADC_TRIGGER_TOP;
+
+static volatile uint8_t clock_step = CLOCK_FULL;
+static volatile bool clock_slow_allowed = false;
+
+
+#ifdef VBUS_LUT
+// Left-adjust so the top 8 bits can be read from ADCH alone
+#define ADMUX_ADJUST    (1 << ADLAR)
+#define ADC_RESULT      ADCH
+#define ADC_RESULT_10   (ADC >> 6)
+#else
+#define ADMUX_ADJUST    0
+#define ADC_RESULT      ADC
+#define ADC_RESULT_10   ADC
+#endif
+
+#if ADC_BANDGAP_PERIOD
+static volatile uint16_t bandgap_raw = 0;
+static volatile bool bandgap_new = false;
+#endif
+
+
+// Write the system clock prescaler. The two writes must be within four cycles
+// of each other, so they are done in asm. Interrupts must be disabled.
+static void write_clkpr(uint8_t div)
+{
+    __asm__ __volatile__ (
+        "sts %0, %1" "\n\t"
+        "sts %0, %2" "\n\t"
+        :
+        : "n" (_SFR_MEM_ADDR(CLKPR)), "r" ((uint8_t)(1 << CLKPCE)), "r" (div)
+        : "memory");
+}
+
+
+// Switch the clock step, along with the Timer0 and ADC prescalers and the
+// Timer1 slot. Slowing down, the clock goes first; speeding up, it goes last:
+// in between, Timer0 and the ADC run slower than intended, never faster.
+// ADCSRA is written whole, with ADIF clear so a pending interrupt is kept.
+// Interrupts must be disabled.
+static void switch_clock(uint8_t step)
+{
+    if (step == CLOCK_SLOW) {
+        write_clkpr(CLOCK_SLOW_SHIFT);
+        TCCR0A = TCCR0A_SLOW;
+        ADCSRA = ADCSRA_SLOW;
+        adc_slot_top = ADC_SLOW_TRIGGER_TOP;
+    } else {
+        TCCR0A = TCCR0A_FULL;
+        ADCSRA = ADCSRA_FULL;
+        write_clkpr(0);
+        adc_slot_top = ADC_TRIGGER_TOP;
+    }
+
+    clock_step = step;
+}
+
+
+// Go back to the full clock at once. Timer1 counts are now eight times
+// shorter, so whatever trigger was due is replaced by one a full slot from
+// now: a conversion still running has time to finish and its interrupt to
+// switch the mux. If that interrupt is still to come, it sets the trigger
+// again from Timer1's restart as usual. Interrupts must be disabled.
+static void leave_slow_clock(void)
+{
+    if (clock_step != CLOCK_SLOW)
+        return;
+
+    switch_clock(CLOCK_FULL);
+
+    uint16_t soon = TCNT1 + (ADC_TRIGGER_TOP + 1u);
+    OCR1A = soon;
+    OCR1B = soon;
+}
 
 
 static void adc_muxsel(uint8_t mux)
 {
-    ADMUX = (1 << REFS0) | (mux & 0x0f);
+    ADMUX = (1 << REFS0) | ADMUX_ADJUST | (mux & 0x0f);
 }
 
 
-void init_adc(void (*callback)(uint16_t pixc, uint16_t dbg))
+// Trigger the next conversion a number of slots after the one just taken.
+// Timer1 restarted from zero at that trigger and has not got far since, so
+// the new TOP is always still ahead of it. There is no hardware multiplier;
+// gaps are one or two slots except at the end of a scan frame.
+static void adc_trigger_after(uint8_t slots)
 {
-    adc_muxsel(MUX_VBUS_PIXC_SENSE);    // Start on first input, ref = vcc
+    uint16_t top = adc_slot_top;
+
+    while (--slots)
+        top += adc_slot_top + 1u;
+
+    OCR1A = top;
+    OCR1B = top;
+}
+
 
-    // Clock is 8 MHz. Divide by 64 to get within the 50..200kHz range
-    ADCSRA = (1 << ADEN) | (1 << ADIE) | (1 << ADPS2) | (1 << ADPS1);
-    ADCSRB = 0;
+// Measure the supply first, so even the first sample pair is corrected.
+#if ADC_BANDGAP_PERIOD
+#define ADC_FIRST_MUX       MUX_BANDGAP
+#define ADC_FIRST_CHANNEL   1
+#else
+#define ADC_FIRST_MUX       BRIDGE_BYTE(0, mux_pixc)
+#define ADC_FIRST_CHANNEL   0
+#endif
+
+
+#define CHANNEL_DIDR(s) | (1 << PIN_VBUS_DBG_SENSE##s) | (1 << PIN_VBUS_PIXC_SENSE##s)
+
+
+void init_adc(void)
+{
+    adc_muxsel(ADC_FIRST_MUX);          // ref = vcc
+
+    // Conversions are auto-triggered by Timer1 compare match B.
+    ADCSRA = ADCSRA_FULL;
+    ADCSRB = (1 << ADTS2) | (1 << ADTS0);
 
     // Disable digital input buffers on analog pins
-    DIDR0 = (1 << PIN_VBUS_DBG_SENSE) | (1 << PIN_VBUS_PIXC_SENSE);
+    DIDR0 = 0 BRIDGE_PINS(CHANNEL_DIDR);
+
+    // Timer1 in CTC mode, no prescaler, counting to TOP = OCR1A. Compare match
+    // B at TOP starts each conversion, so the sample rate is fixed no matter
+    // how long the ISR or callback take.
+    TCCR1A = 0;
+    OCR1A = ADC_TRIGGER_TOP;
+    OCR1B = ADC_TRIGGER_TOP;
+    TCNT1 = 0;
+    TCCR1B = (1 << WGM12) | (1 << CS10);
+}
 
-    // Start conversion
-    adc_callback = callback;
-    ADCSRA |= (1 << ADSC);
+
+// Charging switch of a channel, from the ADC interrupt
+static inline bool isr_charging(uint8_t ch)
+{
+    return *BRIDGE_PORT(ch, dbg_pwr_port) & BRIDGE_BYTE(ch, dbg_pwr_bit);
 }
 
 
+static inline void isr_trip(uint8_t ch, uint8_t reason)
+{
+    *BRIDGE_PORT(ch, dbg_pwr_port) &= ~BRIDGE_BYTE(ch, dbg_pwr_bit);
+    charge_fault[BRIDGE_CH(ch)] = reason;
+}
+
+
+// Frames take one sample pair of a bridge channel at a time, channels in
+// turn. The sequencer and decimator start over with every frame, so they are
+// shared; the trip check follows each channel's own samples.
 ISR(ADC_vect)
 {
-    static uint8_t channel_id = 0;
-    static uint16_t adc_value_pixc = 0;
-    static uint16_t adc_value_dbg = 0;
+    static uint8_t channel_id = ADC_FIRST_CHANNEL;
+    static uint8_t bridge = 0;
+    static struct adc_sequencer seq;
+    static struct adc_decimator decimator;
+    static struct trip_state trip[BRIDGE_COUNT];
+#if ADC_BANDGAP_PERIOD
+    static uint8_t bandgap_countdown = ADC_BANDGAP_PERIOD;
+    static uint8_t frame_gap = 1;
+#endif
+    uint8_t gap = 1;
+
+    MARK_SPAN(MARK_ADC_ISR);
 
     switch(channel_id)
     {
-    case 0:
-        adc_value_pixc = ADC;
-        adc_muxsel(MUX_VBUS_DBG_SENSE);
-        channel_id = 1;
+    case 0: {
+        bool dbg = adc_sequencer_dbg(&seq);
+        uint16_t value = ADC_RESULT;
+
+        if (dbg && trip_check_conversion(value, isr_charging(bridge)) != TRIP_NONE)
+            isr_trip(bridge, TRIP_FLOOR_HIT);
+        adc_accumulate(&decimator, dbg, value, adc_plan_weight(seq.plan, dbg));
+
+        adc_scan_idle = false;
+        if (!adc_sequencer_next(&seq, &gap)) {
+            adc_muxsel(adc_sequencer_dbg(&seq) ? BRIDGE_BYTE(bridge, mux_dbg)
+                                               : BRIDGE_BYTE(bridge, mux_pixc));
+            break;
+        }
+
+        uint16_t adc_value_pixc, adc_value_dbg;
+        adc_decimate(&decimator, &adc_value_pixc, &adc_value_dbg);
+
+        // Fast trip first, so charging is cut before anything else runs
+        uint8_t reason = trip_check(&trip[BRIDGE_CH(bridge)], adc_value_dbg, isr_charging(bridge));
+        if (reason != TRIP_NONE)
+            isr_trip(bridge, reason);
+
+#ifdef STATS
+        if (!adc_queue_pending(&adc_queue))
+            adc_queue_stamp = get_stamp();
+#endif
+        adc_queue_push(&adc_queue, bridge, adc_value_pixc, adc_value_dbg);
+        adc_scan_idle = seq.plan & ADC_PLAN_SCAN;
+        if (BRIDGE_COUNT > 1 && ++bridge == BRIDGE_COUNT)
+            bridge = 0;
+        seq.plan = adc_plan_next[BRIDGE_CH(bridge)];
+        if (clock_slow_allowed && adc_scan_idle && (seq.plan & ADC_PLAN_SCAN)) {
+            // No conversion runs until the idle end of this frame is over.
+            // Count it out in stretched slots, and leave the idle out of the
+            // frames that follow: the stretched slots do the scan.
+            switch_clock(CLOCK_SLOW);
+            gap = (gap + ADC_SCAN_FACTOR - 1u) / ADC_SCAN_FACTOR;
+            adc_scan_idle = false;
+        }
+        if (clock_step == CLOCK_SLOW)
+            seq.plan &= ~ADC_PLAN_SCAN;
+        adc_muxsel(BRIDGE_BYTE(bridge, mux_pixc));
+#if ADC_BANDGAP_PERIOD
+        if (--bandgap_countdown == 0) {
+            // Take the bandgap in the next two slots, then resume the frame
+            bandgap_countdown = ADC_BANDGAP_PERIOD;
+            frame_gap = gap;
+            gap = 1;
+            adc_muxsel(MUX_BANDGAP);
+            channel_id = 1;
+        }
+#endif
         break;
+    }
+#if ADC_BANDGAP_PERIOD
     case 1:
-        adc_value_dbg = ADC;
-        adc_muxsel(MUX_VBUS_PIXC_SENSE);
+        // Mux just switched to the bandgap; let it settle for one conversion
+        channel_id = 2;
+        break;
+    case 2:
+        bandgap_raw = ADC_RESULT_10;
+        bandgap_new = true;
+        adc_muxsel(BRIDGE_BYTE(bridge, mux_pixc));
+        gap = frame_gap;
         channel_id = 0;
-        if (adc_callback)
-            adc_callback(adc_value_pixc, adc_value_dbg);
         break;
+#endif
     }
-    ADCSRA |= (1 << ADSC);
+
+    adc_trigger_after(gap);
+
+    // Nothing else clears the compare flag, and the ADC only triggers on its
+    // rising edge. Clear it to arm the next conversion.
+    TIFR1 = (1 << OCF1B);
+
+    MARK_SPAN(MARK_ADC_ISR);
+}
+
+
+bool get_adc_sample(uint8_t *ch, uint16_t *pixc, uint16_t *dbg)
+{
+    return adc_queue_pop(&adc_queue, ch, pixc, dbg);
+}
+
+
+bool adc_sample_pending(void)
+{
+    return adc_queue_pending(&adc_queue);
+}
+
+
+uint8_t get_adc_overflows(void)
+{
+    return adc_queue.overflows;
+}
+
+
+#ifdef STATS
+uint16_t get_adc_queue_stamp(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        return adc_queue_stamp;
+    }
+    return 0; // shut up warning
+}
+#endif
+
+
+void set_adc_plan(uint8_t ch, enum adc_plan plan, bool scan)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        adc_plan_next[BRIDGE_CH(ch)] = plan | (scan ? ADC_PLAN_SCAN : 0u);
+        if (!scan)
+            leave_slow_clock();
+
+        // Leaving the scan because something is changing: don't sit out the
+        // rest of the idle stretch, start the next frame one slot from now.
+        if (!scan && adc_scan_idle) {
+            uint32_t soon = TCNT1 + (ADC_TRIGGER_TOP + 1u);
+            if (soon < OCR1A) {
+                OCR1A = soon;
+                OCR1B = soon;
+            }
+        }
+    }
+}
+
+
+void set_clock_step(enum clock_step step)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        clock_slow_allowed = (step == CLOCK_SLOW);
+        if (step == CLOCK_FULL)
+            leave_slow_clock();
+    }
+}
+
+
+uint8_t get_charge_fault(uint8_t ch)
+{
+    return charge_fault[BRIDGE_CH(ch)];
+}
+
+
+void clear_charge_fault(uint8_t ch)
+{
+    charge_fault[BRIDGE_CH(ch)] = TRIP_NONE;
+    set_output_groups(ch, applied_outputs[BRIDGE_CH(ch)], OUTPUT_CHARGE);
+}
+
+
+bool get_adc_bandgap(uint16_t *raw)
+{
+#if ADC_BANDGAP_PERIOD
+    bool changed;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        changed = bandgap_new;
+        bandgap_new = false;
+        *raw = bandgap_raw;
+    }
+
+    return changed;
+#else
+    (void) raw;
+    return false;
+#endif
 }
@@ -29,6 +29,21 @@
 #include <stdbool.h>
 #include <inttypes.h>
 
+/// Number of bridge channels: PixC/debug port pairs, each with its own vbus
+/// sense inputs, outputs and hubs. Functions below that take a channel take
+/// it as 0..BRIDGE_COUNT-1. The rev2 board has one; boards with more list
+/// their pins in BRIDGE_PINS (pin_io.h).
+#ifndef BRIDGE_COUNT
+#define BRIDGE_COUNT            1u
+#endif
+#if BRIDGE_COUNT < 1 || BRIDGE_COUNT > 8
+#error "BRIDGE_COUNT must be 1..8"
+#endif
+
+/// A channel index, as a constant 0 on single-bridge builds: per-channel
+/// state and pins then compile to fixed addresses, as with no channels at all.
+#define BRIDGE_CH(ch)           ((BRIDGE_COUNT > 1) ? (ch) : 0u)
+
 /// Initialize GPIO ports to I/O setting and default value
 void init_ports(void);
 
@@ -38,35 +53,235 @@ void init_tick_timer(void);
 /// Return number of 1ms ticks elapsed.
 uint16_t get_ticks(void);
 
-/// Initialize ADC
-/// @param callback - callback function to be called when a pair of samples has been acquired.
-void init_adc(void (*callback)(uint16_t pixc, uint16_t dbg));
+/// Free-running timestamp for timing short intervals, in units of STAMP_US.
+/// Wraps every 65536 units (524 ms).
+uint16_t get_stamp(void);
+#define STAMP_US    8u
+
+/// Sleep (idle) until the next interrupt. Must be called with interrupts
+/// disabled; they are enabled on the way into sleep, so an interrupt arriving
+/// between the caller's last check and the sleep still wakes it.
+void sleep_until_interrupt(void);
+
+/// Initialize ADC. Filtered sample pairs are queued by the ADC interrupt and
+/// read back from the main loop with get_adc_sample(). With several bridge
+/// channels, the ADC takes one sample pair from each in turn.
+void init_adc(void);
+
+/// Take the oldest queued sample pair.
+/// @param ch - receives the channel the pair is from
+/// @return false if no pair is queued
+bool get_adc_sample(uint8_t *ch, uint16_t *pixc, uint16_t *dbg);
+
+/// Return whether a sample pair is queued. Call with interrupts disabled to
+/// decide whether to sleep.
+bool adc_sample_pending(void);
+
+/// Return the number of sample pairs dropped because the queue was full,
+/// saturating at 255.
+uint8_t get_adc_overflows(void);
+
+#ifdef STATS
+/// Return get_stamp() as of when the sample queue last went from empty to
+/// holding a pair.
+uint16_t get_adc_queue_stamp(void);
+#endif
+
+/// Supply measurement. Every ADC_BANDGAP_PERIOD filtered sample pairs, of any
+/// channel, the ADC converts the internal bandgap against AVcc instead of the
+/// next sample pair (the first of two conversions is discarded while the mux
+/// settles). That costs two conversion slots, delaying one sample pair by
+/// 0.5 ms. Set to 0 to disable supply measurement and correction.
+#ifndef ADC_BANDGAP_PERIOD
+#define ADC_BANDGAP_PERIOD      64u
+#endif
+#if ADC_BANDGAP_PERIOD > 255
+#error "ADC_BANDGAP_PERIOD must fit in 8 bits"
+#endif
+
+/// Nominal supply and bandgap voltages the thresholds are computed for
+#define ADC_VCC_NOMINAL         3.3
+#define ADC_BANDGAP_VOLTS       1.1
+
+/// Raw 10-bit bandgap conversion at the nominal supply
+#define ADC_BANDGAP_NOMINAL     (1024.0 * ADC_BANDGAP_VOLTS / ADC_VCC_NOMINAL)
+
+/// Take the latest bandgap conversion, if there is a new one.
+/// @param raw - receives the 10-bit conversion result
+/// @return false if there has been no new conversion since the last call
+bool get_adc_bandgap(uint16_t *raw);
+
+/// Oversampling: every queued sample value is the sum of
+/// 4^ADC_OVERSAMPLE_BITS conversions decimated by 2^ADC_OVERSAMPLE_BITS, giving
+/// ADC_BITS of resolution. At most 3, so the accumulator fits in 16 bits.
+///
+/// With VBUS_LUT, conversions are read left-adjusted as 8 bits and the sum is
+/// averaged back down to 8 bits instead, to suit the table classifier.
+#define ADC_OVERSAMPLE_BITS     1
+#define ADC_OVERSAMPLE_COUNT    (1u << (2 * ADC_OVERSAMPLE_BITS))
+#ifdef VBUS_LUT
+#define ADC_CONV_BITS           8
+#define ADC_BITS                8
+#else
+#define ADC_CONV_BITS           10
+#define ADC_BITS                (10 + ADC_OVERSAMPLE_BITS)
+#endif
+/// Right shift from the sum of ADC_OVERSAMPLE_COUNT conversions to ADC_BITS
+#define ADC_DECIMATE_SHIFT      (ADC_CONV_BITS + 2 * ADC_OVERSAMPLE_BITS - ADC_BITS)
+
+/// Rate at which filtered sample pairs are queued, in Hz, outside the
+/// low-rate scan. Conversions are timer-triggered, so this is exact.
+#define ADC_FRAME_HZ            500u
+/// Rate of sample pairs of each bridge channel
+#define ADC_SAMPLE_HZ           (ADC_FRAME_HZ / BRIDGE_COUNT)
+/// Rate of conversion slots: two channels, each oversampled. Depending on the
+/// sampling plan, not every slot is used.
+#define ADC_CONVERSION_HZ       (ADC_FRAME_HZ * 2u * ADC_OVERSAMPLE_COUNT)
+
+/// Sampling plans. The critical channel is oversampled as usual; the other is
+/// converted only once per filtered sample, which cuts conversions (and ADC
+/// interrupts) by three eighths. See adc_plan.h.
+enum adc_plan {
+    ADC_PLAN_BALANCED,  ///< Both channels oversampled
+    ADC_PLAN_PIXC,      ///< PixC vbus critical
+    ADC_PLAN_DBG,       ///< Debug vbus critical
+};
+
+/// In the low-rate scan, filtered samples come ADC_SCAN_FACTOR times less often
+#ifndef ADC_SCAN_FACTOR
+#define ADC_SCAN_FACTOR         4u
+#endif
+
+/// Switch a channel's sampling plan. Takes effect from its next filtered sample.
+/// @param scan - also drop to the low-rate scan
+void set_adc_plan(uint8_t ch, enum adc_plan plan, bool scan);
+
+/// System clock steps. At CLOCK_SLOW the CPU and I/O clocks run at
+/// F_CPU >> CLOCK_SLOW_SHIFT. Timer0 and the ADC prescalers are switched along
+/// with the clock, so get_ticks(), get_stamp() and the ADC clock keep their
+/// rates at either step.
+///
+/// The slow step only ever runs during the low-rate scan: instead of idling
+/// the end of each scan frame at full speed, every conversion slot is
+/// stretched to ADC_SCAN_FACTOR slots, so filtered samples come at the same
+/// rate. It is entered at the end of a scan frame, and left at once when the
+/// scan ends or the full clock is requested.
+enum clock_step {
+    CLOCK_FULL,
+    CLOCK_SLOW,
+};
+
+#define CLOCK_SLOW_SHIFT        3
 
-/// Return ADC value for floating-point voltage
-#define ADC_VAL(voltage) ((uint16_t)(1024.0 * (voltage) / 6.6) & 0x3ffu)
+/// Request a clock step. CLOCK_FULL takes effect at once; CLOCK_SLOW is
+/// allowed from then on, and applies while the ADC is in the low-rate scan.
+void set_clock_step(enum clock_step step);
 
-void set_leds_host(void);       ///< Switch to "HOST" LED
-void set_leds_dev(void);        ///< Switch to "DEV" LED
-void set_leds_off(void);        ///< No LEDs
+/// Stop the clocks of peripherals the firmware does not use (PRR).
+void init_power(void);
 
+/// Number of filtered samples spanning a time in ms, at least one
+#define ADC_MS_TO_SAMPLES(ms)   ((ms) * ADC_SAMPLE_HZ >= 1000u ? (ms) * ADC_SAMPLE_HZ / 1000u : 1u)
 
-void set_charge_enabled(void);  ///< Enable charging from debug port to PixC
-void set_charge_disabled(void); ///< Disable charging from debug port to PixC
-bool is_charge_enabled(void);   ///< Return whether charging is enabled
+/// Return raw 10-bit conversion result for floating-point voltage, at the
+/// nominal supply
+#define ADC_RAW_VAL(voltage) ((uint16_t)(1024.0 * (voltage) / 6.6) & 0x3ffu)
 
+/// Return filtered sample value (ADC_BITS wide) for floating-point voltage
+#define ADC_VAL(voltage) ((uint16_t)((1ul << ADC_BITS) * (voltage) / 6.6) & ((1u << ADC_BITS) - 1))
 
+/// Complete output configurations. Each sets the LEDs, charging, USB mux,
+/// hub vbus detect and CC pulls at once, leaving the hub reset alone.
+enum output_config {
+    OUTPUTS_IDLE,   ///< LEDs off, not charging, PixC is host
+    OUTPUTS_HOST,   ///< HOST LED, not charging, PixC is host
+    OUTPUTS_DEV,    ///< DEV LED, charging, PixC is device
+    OUTPUTS_OFF,    ///< LEDs off, not charging, no hub vbus detect, CC open
+};
+
+/// Groups of output pins, for switching a configuration in steps
+#define OUTPUT_CHARGE   0x01u   ///< Charging switch
+#define OUTPUT_VBUSDET  0x02u   ///< Hub vbus detect
+#define OUTPUT_CC       0x04u   ///< CC pulls
+#define OUTPUT_MUX      0x08u   ///< USB mux and LEDs
+#define OUTPUT_ALL      0x0fu
+
+/// Switch all of a channel's outputs to a configuration in one write per port
+/// register, with interrupts off, so no intermediate combination appears on
+/// the pins.
+void set_outputs(uint8_t ch, enum output_config cfg);
+
+/// Switch some groups of a channel's outputs (OUTPUT_* flags) to a
+/// configuration, the same way; the others are left as they are.
+void set_output_groups(uint8_t ch, enum output_config cfg, uint8_t groups);
+
+/// Return the groups of a channel's outputs (OUTPUT_* flags) whose pins differ
+/// between two configurations.
+uint8_t get_output_changes(uint8_t ch, enum output_config from, enum output_config to);
+
+
+bool is_charge_enabled(uint8_t ch);    ///< Return whether a channel is charging
+
+/// Return a channel's charge fault latched by the ADC interrupt's fast trip
+/// check (enum trip_reason), or 0. While latched, charging stays off: enabling
+/// it, directly or through set_outputs(), leaves it off.
+uint8_t get_charge_fault(uint8_t ch);
+
+/// Clear a channel's charge fault and reapply the configuration last written
+/// to its charging switch, turning charging back on if it calls for it.
+void clear_charge_fault(uint8_t ch);
+
+
+/// CC pull directions
 enum CC_PULL_TYPE { CC_OPEN, CC_DOWN, CC_UP, CC_MID };
 
-void pull_cc1(enum CC_PULL_TYPE val);    ///< Pull CC1 in the specified direction
-void pull_cc2(enum CC_PULL_TYPE val);    ///< Pull CC2 in the specified direction
 
+void set_hub_reset(uint8_t ch, bool val);  ///< Set whether a channel's hubs are held in reset
+
+
+
+/// Scope markers, for timing the firmware on the board with a logic analyzer
+/// on the marker pin (MOSI on the ISP header). MARKERS picks the probe points
+/// that drive it, or'ed together; at 0, the default, they compile to nothing.
+/// Every mark toggles the pin, so points never garble each other's edges: a
+/// span shows as one edge at each end, an event as a pulse of a few cycles.
+#ifndef MARKERS
+#define MARKERS 0
+#endif
+#define MARK_ADC_ISR    0x01u   ///< Span: the ADC interrupt
+#define MARK_COMMIT     0x02u   ///< Event: a debounced (or provisional) mode is committed
+#define MARK_OUTPUTS    0x04u   ///< Span: set_outputs() switching the outputs
+#define MARK_HUB_RESET  0x08u   ///< Event: hubs put into or released from reset
+
+void toggle_marker(void);       ///< Toggle the marker pin
+
+#define MARK_SPAN(point)    do { if (MARKERS & (point)) toggle_marker(); } while (0)
+#define MARK_EVENT(point)   do { if (MARKERS & (point)) { toggle_marker(); toggle_marker(); } } while (0)
+
+
+#ifdef TWI_TARGET
+/// 7-bit address of the TWI target (see telemetry.h)
+#ifndef TWI_ADDRESS
+#define TWI_ADDRESS 0x2c
+#endif
+
+/// Start answering as a TWI target at TWI_ADDRESS, serving a register file by
+/// the protocol in twi_target.h.
+/// @param regs - register file, only to be written while the bus is idle
+/// @param size - number of registers
+/// @param writable - first register the controller may write
+void init_twi(volatile uint8_t *regs, uint8_t size, uint8_t writable);
+
+/// Return whether a TWI transaction is under way. Call with interrupts
+/// disabled, and keep them so while writing the register file.
+bool is_twi_busy(void);
+#endif
 
-void set_usb_mux_debug(void);   ///< Set USB mux to debug mode (PixC is device)
-void set_usb_mux_normal(void);  ///< Set USB mux to normal mode (PixC is host)
 
+/// Baud rate of the trace dump port (8N1, bit-banged)
+#define DUMP_BAUD 115200u
 
-void set_hub_reset(bool val);   ///< Set whether the hubs are held in reset
-void set_hub1_vbus(bool val);   ///< Set whether hub 1 (downstream of pixel C, for host mode) sees vbus
-void set_hub2_vbus(bool val);   ///< Set whether hub 2 (upstream of pixel C, for device mode) sees vbus
+bool is_dump_requested(void);   ///< Return whether the host is requesting a trace dump
+void dump_putc(char c);         ///< Send a character on the trace dump port
 
 #endif // _HARDWARE_H
@@ -20,95 +20,241 @@
 // OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
 // WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
+#include "main.h"
 #include "hardware.h"
 #include "vbus.h"
+#include "trace.h"
+#include "timer.h"
+#include "sched.h"
+#include "config.h"
+#include "trip.h"
+#include "stats.h"
+#include "power.h"
+#include "telemetry.h"
+#include "policy.h"
+#include "sequence.h"
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <avr/wdt.h>
-#include <util/atomic.h>
-#include <util/delay.h>
+#include <stdbool.h>
 
+// Mode change state of one bridge channel. Each channel changes mode on its
+// own; they only share the main loop.
+struct bridge {
+    uint8_t last_mode;      ///< enum vbus_mode
+    bool hubs_held;         ///< Hubs in reset, by a pulse or from power-on
+    bool change_pending;    ///< Waiting for the outputs or hub reset to finish
+    bool booting;           ///< Boot mode not confirmed yet
+};
 
-static void set_host_mode(void);
-static void set_dev_mode(void);
+// Set up by fw_init(): init_ports() leaves the hubs in reset until the boot
+// mode is confirmed.
+static struct bridge bridges[BRIDGE_COUNT];
 
-// Reset hubs and CC pins for 500ms if the state changes. Stores the previous state.
-static void reset_on_change(enum vbus_mode mode);
+#define BRIDGE(ch)  (&bridges[BRIDGE_CH(ch)])
+
+// Apply the policy for a change from the previous mode (policy.h): start its
+// hub reset pulse, if any, then sequence the outputs (sequence.h). Stores the
+// previous mode. Does not block: a further change while the hubs are still
+// held restarts the pulse for the new mode, or lets the running one finish if
+// the new change needs none.
+static void change_mode(uint8_t ch, enum vbus_mode mode);
+
+// Complete a mode change once its output sequence and hub reset pulse have
+// both finished. Callback of the sequence, and through hub_reset_done() of
+// the pulse.
+static void change_step_done(uint8_t ch);
+
+// End of a hub reset pulse. TIMER_HUB_RESET callback.
+static void hub_reset_done(enum timer_id id);
+
+// Handle the boot mode: the hubs are held in reset from power-on until it is
+// confirmed, so they never see a provisional mode. Returns whether it handled
+// the change; false leaves it to the normal path.
+static bool boot_mode(uint8_t ch, enum vbus_mode mode);
+
+// Release the hubs from reset.
+static void release_hubs(uint8_t ch);
+
+// Tasks, see sched.h
+static void vbus_task(void);
+static void mode_task(void);
+static void diag_task(void);
+
+static const task_fn tasks[TASK_COUNT] PROGMEM = {
+    [TASK_TRIP]     = &trip_poll,
+    [TASK_VBUS]     = &vbus_task,
+    [TASK_MODE]     = &mode_task,
+    [TASK_TIMERS]   = &timer_poll,
+    [TASK_POWER]    = &power_poll,
+    [TASK_DIAG]     = &diag_task,
+};
 
 int main(void)
+{
+    fw_init();
+
+    for(;;) {
+        fw_poll();
+    }
+}
+
+
+void fw_init(void)
 {
     wdt_disable();
+    config_load();
     init_ports();
+    init_power();
     init_tick_timer();
-    init_adc(&vbus_adc_callback);
+    init_adc();
+    sched_init(tasks);
+    telemetry_init();
     sei();
 
-    set_hub_reset(false);
-    set_charge_disabled();
-    set_host_mode();
+    // Hubs stay in reset, as init_ports() left them, until the boot mode is
+    // confirmed.
+    for (uint8_t ch = 0; ch < BRIDGE_COUNT; ++ch) {
+        bridges[ch] = (struct bridge) {
+            .last_mode = VBUS_WAIT, .hubs_held = true, .booting = true,
+        };
+        sequence_jump(ch, OUTPUTS_IDLE);
+    }
+}
 
-    for(;;) {
-        enum vbus_mode mode = get_current_vbus_mode();
-
-        reset_on_change(mode);
-
-        switch(mode) {
-        case VBUS_WAIT:
-            continue;
-
-        case VBUS_NONE:
-            set_leds_off();
-            set_charge_disabled();
-            set_host_mode();
-            break;
-
-        case VBUS_PIXC_ONLY:
-        case VBUS_BOTH_DIODE:
-            set_leds_host();
-            set_charge_disabled();
-            set_host_mode();
-            break;
-
-        case VBUS_DEBUG_ONLY:
-        case VBUS_BOTH:
-            set_leds_dev();
-            set_charge_enabled();
-            set_dev_mode();
-            break;
+
+void fw_poll(void)
+{
+    sched_poll();
+}
+
+
+static void vbus_task(void)
+{
+    if (vbus_poll()) {
+        sched_post(TASK_MODE);
+    }
+}
+
+
+// Outputs are only written when the debounced mode actually changes.
+static void mode_task(void)
+{
+    enum vbus_mode mode;
+
+    for (uint8_t ch = 0; ch < BRIDGE_COUNT; ++ch) {
+        if (get_vbus_mode_change(ch, &mode) && !boot_mode(ch, mode)) {
+            change_mode(ch, mode);
+            trace_event(TRACE_EV_APPLY, mode);
         }
     }
 }
 
 
-static void set_host_mode(void)
+// Dumps go out a line per pass, so as not to hold the loop for the whole 10
+// to 20 ms they take. The longest line, a stats row, is 21 characters: 1.8 ms
+// at 115200 baud, the longest any task blocks the loop and so what the sample
+// queue must cover (adc_queue.h).
+static void diag_task(void)
 {
-    set_usb_mux_normal();
-    set_hub1_vbus(true);
-    set_hub2_vbus(false);
-    pull_cc1(CC_DOWN);
-    pull_cc2(CC_OPEN);
+    trace_poll();
+    stats_poll();
+    telemetry_poll();
 }
 
 
-static void set_dev_mode(void)
+static bool boot_mode(uint8_t ch, enum vbus_mode mode)
 {
-    set_usb_mux_debug();
-    set_hub1_vbus(false);
-    set_hub2_vbus(true);
-    pull_cc1(CC_DOWN);
-    pull_cc2(CC_DOWN);
+    struct bridge *b = BRIDGE(ch);
+
+    if (!b->booting) {
+        return false;
+    }
+
+    if (is_vbus_mode_provisional(ch)) {
+        // Set up for the provisional mode behind the reset, so a confirmation
+        // finds the outputs already right. Nothing sees them yet, so there is
+        // no need to sequence them.
+        sequence_jump(ch, get_mode_policy(b->last_mode, mode).outputs);
+        if (ch == 0)
+            telemetry_begin(b->last_mode, mode);
+        b->last_mode = mode;
+        trace_event(TRACE_EV_PROVISIONAL, mode);
+        return true;
+    }
+
+    b->booting = false;
+    if (mode != b->last_mode) {
+        // Provisional mode was wrong: treat the confirmed one as a change.
+        return false;
+    }
+
+    // Confirmed as it was: the power-on reset was all the hubs needed.
+    trace_event(TRACE_EV_APPLY, mode);
+    release_hubs(ch);
+    return true;
 }
 
 
-static void reset_on_change(enum vbus_mode mode)
+static void change_mode(uint8_t ch, enum vbus_mode mode)
 {
-    static enum vbus_mode last_mode = VBUS_WAIT;
+    struct bridge *b = BRIDGE(ch);
+    struct mode_policy policy = get_mode_policy(b->last_mode, mode);
 
-    // Hold hubs in reset briefly if the state has changed
-    if (mode != last_mode) {
-        set_hub_reset(true);
-        _delay_ms(500);
-        set_hub_reset(false);
+    // Hold hubs in reset briefly if the policy asks for it. If a reset is
+    // already running, start over: the hubs must see the full pulse after
+    // the last change, not the first. A change with no pulse of its own
+    // still waits for a running one.
+    if (mode != b->last_mode) {
+        uint16_t reset_ms = hub_reset_ms(policy.reset);
+
+        if (ch == 0)
+            telemetry_begin(b->last_mode, mode);
+        b->change_pending = true;
+        if (reset_ms) {
+            set_hub_reset(ch, true);
+            b->hubs_held = true;
+            timer_start(TIMER_HUB_RESET + BRIDGE_CH(ch), reset_ms, 0, &hub_reset_done);
+            trace_event(TRACE_EV_HUB_RESET, mode);
+        }
     }
 
-    last_mode = mode;
+    b->last_mode = mode;
+    sequence_start(ch, policy.outputs, &change_step_done);
+}
+
+
+static void hub_reset_done(enum timer_id id)
+{
+    change_step_done(BRIDGE_CH(id - TIMER_HUB_RESET));
+}
+
+
+static void change_step_done(uint8_t ch)
+{
+    struct bridge *b = BRIDGE(ch);
+
+    if (!b->change_pending || sequence_running(ch) ||
+            timer_running(TIMER_HUB_RESET + BRIDGE_CH(ch))) {
+        return;
+    }
+
+    // Hubs still held, by a pulse or from power-on, are released only now
+    // that the outputs are right.
+    b->change_pending = false;
+    if (b->hubs_held) {
+        release_hubs(ch);
+    } else if (ch == 0) {
+        telemetry_complete();
+    }
+}
+
+
+static void release_hubs(uint8_t ch)
+{
+    set_hub_reset(ch, false);
+    BRIDGE(ch)->hubs_held = false;
+    trace_event(TRACE_EV_HUB_RELEASE, ch);
+    if (ch == 0)
+        telemetry_complete();
 }
@@ -53,9 +53,20 @@
 #define PIN_VBUS_PIXC_SENSE 3
 #define MUX_VBUS_PIXC_SENSE (3 << MUX0)
 
+// PC4 is also the TWI's SDA. Boards for TWI_TARGET builds have the debug vbus
+// divider moved to PC1, which is unconnected on rev2.
+#ifdef TWI_TARGET
+#define PRT_VBUS_DBG_SENSE  C
+#define PIN_VBUS_DBG_SENSE  1
+#define MUX_VBUS_DBG_SENSE  (1 << MUX0)
+#else
 #define PRT_VBUS_DBG_SENSE  C
 #define PIN_VBUS_DBG_SENSE  4
 #define MUX_VBUS_DBG_SENSE  (4 << MUX0)
+#endif
+
+// Internal 1.1 V bandgap, for supply voltage measurement
+#define MUX_BANDGAP         (14 << MUX0)
 
 #define PRT_CC1PD           B
 #define PIN_CC1PD           7
@@ -69,9 +80,30 @@
 #define PRT_CC2PU           B
 #define PIN_CC2PU           1
 
+// Bridge channels, one X(suffix) each. A channel's pins are the bridge pins
+// above (LED_A to CC2PU, and the two sense inputs with their MUX_ values) with
+// its suffix appended, so a board with a second bridge defines PRT_LED_A_1,
+// PIN_LED_A_1 and so on, and lists X(_1) after X(). Rev2 has the one bridge,
+// with no suffix.
+#define BRIDGE_PINS(X)      X()
+
+// Trace dump port, on the ISP header: MISO is a serial TX, and the host
+// pulls SCK low to request a dump. Both are idle while programming since
+// the MCU is then held in reset.
+#define PRT_TRACE_TX        B
+#define PIN_TRACE_TX        4
+
+#define PRT_TRACE_REQ       B
+#define PIN_TRACE_REQ       5
+
 #define PRT_MCUnRST         C
 #define PIN_MCUnRST         6
 
+// Scope marker (see MARKERS in hardware.h), on the ISP header's MOSI. CLKO on
+// PB0 would do as well, but the fuses have clock output enabled there.
+#define PRT_MARKER          B
+#define PIN_MARKER          3
+
 
 /// @internal helper macro for _CONCAT
 #define _HELP_CONCAT(x, y) x ## y
@@ -90,6 +122,14 @@
 /// @internal extract and return the pin number for a pin by name
 #define _NUM_FOR_PIN(pin) _CONCAT(PIN_, pin)
 
+/// @internal port indices, so ports can be compared in constant expressions
+#define _PORTIDX_B 0
+#define _PORTIDX_C 1
+#define _PORTIDX_D 2
+
+/// Index of the port a pin is on: 0 = B, 1 = C, 2 = D
+#define PORTIDX(pin)    _CONCAT(_PORTIDX_, _CONCAT(PRT_, pin))
+
 
 
 /// Configure a pin as output
@@ -107,9 +147,16 @@
 /// Write v to a pin
 #define PVAL(pin, val)  do { if (val) { PHIGH(pin); } else { PLOW(pin); } } while (0)
 
+/// Toggle a pin's output value
+#define PTOGGLE(pin)    do { _PIN_FOR_PIN(pin) = 1 << (_NUM_FOR_PIN(pin)); } while (0)
+
 /// Read a pin
 #define PGET(pin)       ( _PIN_FOR_PIN(pin) & (1 << (_NUM_FOR_PIN(pin))) )
 
+/// Bit mask of a pin if it is on the port with index idx, else 0. This is a
+/// constant expression, for building whole-port images at compile time.
+#define PBIT(pin, idx)  ((PORTIDX(pin) == (idx)) ? (1 << (_NUM_FOR_PIN(pin))) : 0)
+
 /// Read a pin's output value
 #define PGETOUT(pin)    ( _PORT_FOR_PIN(pin) & (1 << (_NUM_FOR_PIN(pin))) )
 
@@ -0,0 +1,73 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "policy.h"
+#include "config.h"
+
+#include <avr/pgmspace.h>
+
+// Entries are packed into a byte: output configuration in the low nibble, hub
+// reset kind in the high one.
+#define POLICY(outputs, reset)  (OUTPUTS_##outputs | HUB_RESET_##reset << 4)
+#define POLICY_OUTPUTS(p)       ((enum output_config) ((p) & 0x0fu))
+#define POLICY_RESET(p)         ((enum hub_reset_kind) ((p) >> 4))
+
+// Rows are the mode changed from, columns the mode changed to. VBUS_WAIT is
+// never changed to; its column only keeps the table square. The PixC keeps
+// its role between PIXC_ONLY and BOTH_DIODE, and between DEBUG_ONLY and BOTH,
+// with the same outputs, so those changes leave the hubs alone.
+static const uint8_t policies[VBUS_MODE_COUNT][VBUS_MODE_COUNT] PROGMEM = {
+    //                   WAIT               NONE                 PIXC_ONLY                DEBUG_ONLY              BOTH                    BOTH_DIODE
+    [VBUS_WAIT]       = {POLICY(IDLE, NONE), POLICY(IDLE, TO_NONE), POLICY(HOST, ROLE_SWAP), POLICY(DEV, ROLE_SWAP), POLICY(DEV, ROLE_SWAP), POLICY(HOST, ROLE_SWAP)},
+    [VBUS_NONE]       = {POLICY(IDLE, NONE), POLICY(IDLE, NONE),    POLICY(HOST, SAME_ROLE), POLICY(DEV, ROLE_SWAP), POLICY(DEV, ROLE_SWAP), POLICY(HOST, SAME_ROLE)},
+    [VBUS_PIXC_ONLY]  = {POLICY(IDLE, NONE), POLICY(IDLE, TO_NONE), POLICY(HOST, NONE),      POLICY(DEV, ROLE_SWAP), POLICY(DEV, ROLE_SWAP), POLICY(HOST, NONE)},
+    [VBUS_DEBUG_ONLY] = {POLICY(IDLE, NONE), POLICY(IDLE, TO_NONE), POLICY(HOST, ROLE_SWAP), POLICY(DEV, NONE),      POLICY(DEV, NONE),      POLICY(HOST, ROLE_SWAP)},
+    [VBUS_BOTH]       = {POLICY(IDLE, NONE), POLICY(IDLE, TO_NONE), POLICY(HOST, ROLE_SWAP), POLICY(DEV, NONE),      POLICY(DEV, NONE),      POLICY(HOST, ROLE_SWAP)},
+    [VBUS_BOTH_DIODE] = {POLICY(IDLE, NONE), POLICY(IDLE, TO_NONE), POLICY(HOST, NONE),      POLICY(DEV, ROLE_SWAP), POLICY(DEV, ROLE_SWAP), POLICY(HOST, NONE)},
+};
+
+
+struct mode_policy get_mode_policy(enum vbus_mode from, enum vbus_mode to)
+{
+    uint8_t p = pgm_read_byte(&policies[from][to]);
+
+    return (struct mode_policy) {
+        .outputs = POLICY_OUTPUTS(p),
+        .reset = POLICY_RESET(p),
+    };
+}
+
+
+uint16_t hub_reset_ms(enum hub_reset_kind kind)
+{
+    switch (kind) {
+    case HUB_RESET_ROLE_SWAP:
+        return config.hub_reset_role_swap_ms;
+    case HUB_RESET_SAME_ROLE:
+        return config.hub_reset_same_role_ms;
+    case HUB_RESET_TO_NONE:
+        return config.hub_reset_to_none_ms;
+    default:
+        return 0;
+    }
+}
@@ -0,0 +1,70 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+/// @file policy.h
+/// Mode change policy: what to do when the vbus mode changes from one mode to
+/// another.
+///
+/// A table in flash, indexed by (from, to), gives the output configuration to
+/// switch to, which sets the LEDs along with everything else, and which hub
+/// reset pulse to give, if any. The pulse lengths come from the configuration
+/// (config.h), so the table only says which kind of change it is. Changes that
+/// leave the outputs as they were need no reset: the hubs see the same data
+/// path and power, and resetting them would only cost a re-enumeration.
+///
+/// The main loop applies a policy with sequence_start() (sequence.h), which
+/// takes the outputs there break before make, and the hub reset timer, which
+/// holds the hubs until the sequence is done; nothing else about a mode
+/// change is decided in code.
+
+#ifndef _POLICY_H
+#define _POLICY_H 1
+
+#include "vbus.h"
+#include "hardware.h"
+
+#include <inttypes.h>
+
+/// Kinds of hub reset, each with its own pulse length in the configuration
+enum hub_reset_kind {
+    HUB_RESET_NONE,         ///< Leave the hubs running
+    HUB_RESET_ROLE_SWAP,    ///< config.hub_reset_role_swap_ms
+    HUB_RESET_SAME_ROLE,    ///< config.hub_reset_same_role_ms
+    HUB_RESET_TO_NONE,      ///< config.hub_reset_to_none_ms
+};
+
+/// What to do on a mode change
+struct mode_policy {
+    enum output_config outputs;
+    enum hub_reset_kind reset;
+};
+
+/// Look up the policy for a change between two modes. A mode "changing" to
+/// itself gets its outputs and no reset.
+struct mode_policy get_mode_policy(enum vbus_mode from, enum vbus_mode to);
+
+/// Return how long to hold the hubs in reset for a kind of reset, in ms. Zero,
+/// also from the configuration, means no reset.
+uint16_t hub_reset_ms(enum hub_reset_kind kind);
+
+#endif // _POLICY_H
@@ -0,0 +1,46 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+/// @file power.h
+/// Power manager: drops the system clock while the vbus mode is settled.
+///
+/// After the mode has held for a while the ADC only scans for a change, and
+/// the firmware has little to do between samples. power_poll() then allows
+/// the slow clock step (see enum clock_step), which the ADC interrupt enters
+/// at the end of a scan frame. Any change seen in the samples ends the scan,
+/// and with it the slow step, before the next sample is taken, so debouncing
+/// and switching always run at the full clock.
+///
+/// A trace dump needs the full clock for its bit timing; a dump request keeps
+/// the clock at full speed until it is released. TWI_TARGET builds never slow
+/// down, as the TWI needs a CPU clock of at least 16 times SCL. Peripherals
+/// the firmware never uses are stopped once at startup by init_power().
+
+#ifndef _POWER_H
+#define _POWER_H 1
+
+/// Pick the clock step for the current state. Call from the main loop, at
+/// least once per tick and before a trace dump can start.
+void power_poll(void);
+
+#endif // _POWER_H
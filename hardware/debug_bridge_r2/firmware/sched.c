@@ -0,0 +1,99 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "sched.h"
+#include "hardware.h"
+#include "stats.h"
+
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+_Static_assert(TASK_COUNT <= 8, "ready mask is 8 bits");
+
+static const task_fn *task_table = NULL;  ///< In flash
+static uint8_t ready = 0;
+static uint16_t last_tick = 0;
+static uint8_t last_fault = 0;     ///< Bit per bridge channel with a charge fault
+
+
+void sched_init(const task_fn *tasks)
+{
+    task_table = tasks;
+    ready = 0;
+    last_tick = get_ticks();
+}
+
+
+void sched_post(enum task_id id)
+{
+    ready |= TASK_BIT(id);
+}
+
+
+// Make tasks ready for any events that have come in. Interrupts must be
+// disabled, so nothing can arrive between this and the decision to sleep.
+static void collect_events(void)
+{
+    uint16_t tick = get_ticks();
+    uint8_t fault = 0;
+
+    for (uint8_t ch = 0; ch < BRIDGE_COUNT; ++ch) {
+        if (get_charge_fault(ch))
+            fault |= 1u << ch;
+    }
+
+    if (adc_sample_pending())
+        ready |= SCHED_ON_SAMPLE;
+    if (tick != last_tick)
+        ready |= SCHED_ON_TICK;
+    if (fault != last_fault)
+        ready |= SCHED_ON_FAULT;
+    last_tick = tick;
+    last_fault = fault;
+}
+
+
+void sched_poll(void)
+{
+    cli();
+    collect_events();
+    if (!ready) {
+        sleep_until_interrupt();
+        sei();
+        return;
+    }
+    sei();
+
+    uint8_t id = 0;
+    while (!(ready & TASK_BIT(id)))
+        ++id;
+
+    // Cleared first, so the task can post itself to run again.
+    ready &= ~TASK_BIT(id);
+    uint16_t start = stats_stamp();
+    ((task_fn) pgm_read_ptr(&task_table[id]))();
+    // Dump lines block for milliseconds by design; leave them out.
+    if (id != TASK_DIAG)
+        stats_task_time(start);
+}
@@ -0,0 +1,68 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+/// @file sched.h
+/// Cooperative run-to-completion task scheduler.
+///
+/// Each task is a function that does a bounded amount of work and returns. A
+/// task runs when it has been made ready, either by sched_post() or by an
+/// interrupt event it is bound to below. Each pass of sched_poll() runs the
+/// highest-priority ready task once; with nothing ready, it sleeps until the
+/// next interrupt. A busy high-priority task therefore delays lower ones by at
+/// most its own run time per pass.
+
+#ifndef _SCHED_H
+#define _SCHED_H 1
+
+#include <inttypes.h>
+
+/// Tasks, highest priority first. At most 8.
+enum task_id {
+    TASK_TRIP,      ///< Count a charge trip and schedule its retry
+    TASK_VBUS,      ///< Classify and debounce queued ADC samples
+    TASK_MODE,      ///< Apply a new debounced vbus mode
+    TASK_TIMERS,    ///< Dispatch expired software timers
+    TASK_POWER,     ///< Pick the clock step; before TASK_DIAG, which may dump
+    TASK_DIAG,      ///< Trace dump and other diagnostics
+    TASK_COUNT
+};
+
+#define TASK_BIT(id)        (1u << (id))
+
+/// Tasks made ready by interrupt events
+#define SCHED_ON_SAMPLE     TASK_BIT(TASK_VBUS)
+#define SCHED_ON_TICK       (TASK_BIT(TASK_TIMERS) | TASK_BIT(TASK_POWER) | TASK_BIT(TASK_DIAG))
+#define SCHED_ON_FAULT      TASK_BIT(TASK_TRIP)     ///< Charge fault latched or cleared
+
+typedef void (*task_fn)(void);
+
+/// Set the task table, indexed by enum task_id and kept in flash (PROGMEM).
+/// No task is ready until an event or sched_post() makes it so.
+void sched_init(const task_fn *tasks);
+
+/// Make a task ready. Main loop (task) context only.
+void sched_post(enum task_id id);
+
+/// Run the highest-priority ready task, or sleep if there is none.
+void sched_poll(void);
+
+#endif // _SCHED_H
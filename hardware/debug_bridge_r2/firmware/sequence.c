@@ -0,0 +1,126 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "sequence.h"
+
+#include <avr/pgmspace.h>
+#include <inttypes.h>
+
+struct sequence_step {
+    uint8_t groups;     ///< OUTPUT_* flags switched by this step
+    uint8_t off;        ///< Switch them to OUTPUTS_OFF rather than the target
+    uint8_t delay_ms;   ///< Wait before the next step
+};
+
+static const struct sequence_step steps[] PROGMEM = {
+    { OUTPUT_CHARGE | OUTPUT_VBUSDET,   1, SEQUENCE_BREAK_MS },
+    { OUTPUT_CC,                        1, SEQUENCE_OPEN_CC_MS },
+    { OUTPUT_MUX,                       0, SEQUENCE_MUX_MS },
+    { OUTPUT_CC | OUTPUT_VBUSDET,       0, 0 },
+    { OUTPUT_CHARGE,                    0, 0 },
+};
+
+#define STEP_COUNT  (sizeof steps / sizeof steps[0])
+
+// Sequence state of one bridge channel; zero is idle.
+struct sequence_channel {
+    uint8_t target;         ///< enum output_config
+    uint8_t changes;        ///< OUTPUT_* groups the sequence switches
+    uint8_t steps_left;     ///< Steps not applied yet, counting down to the last
+    sequence_fn on_done;
+};
+
+static struct sequence_channel channels[BRIDGE_COUNT];
+
+#define CHANNEL(ch) (&channels[BRIDGE_CH(ch)])
+
+// Run the next steps of a channel's sequence. TIMER_SEQUENCE callback.
+static void step_due(enum timer_id id);
+
+
+// Apply steps up to the next one with a delay. A step switches only the groups
+// that change; one with none to switch is skipped along with its delay.
+static void run(uint8_t ch)
+{
+    struct sequence_channel *c = CHANNEL(ch);
+
+    while (c->steps_left) {
+        const struct sequence_step *s = &steps[STEP_COUNT - c->steps_left--];
+        uint8_t groups = pgm_read_byte(&s->groups) & c->changes;
+        uint8_t delay_ms = pgm_read_byte(&s->delay_ms);
+
+        if (!groups)
+            continue;
+        set_output_groups(ch, pgm_read_byte(&s->off) ? OUTPUTS_OFF : c->target, groups);
+        if (delay_ms) {
+            timer_start(TIMER_SEQUENCE + BRIDGE_CH(ch), delay_ms, 0, &step_due);
+            return;
+        }
+    }
+
+    c->on_done(ch);
+}
+
+
+static void step_due(enum timer_id id)
+{
+    run(BRIDGE_CH(id - TIMER_SEQUENCE));
+}
+
+
+void sequence_start(uint8_t ch, enum output_config cfg, sequence_fn done)
+{
+    struct sequence_channel *c = CHANNEL(ch);
+
+    c->on_done = done;
+
+    if (cfg == c->target) {
+        if (!sequence_running(ch))
+            done(ch);
+        return;
+    }
+
+    // An aborted sequence leaves the outputs part way, so start over in full.
+    c->changes = sequence_running(ch) ? OUTPUT_ALL : get_output_changes(ch, c->target, cfg);
+    c->target = cfg;
+    c->steps_left = STEP_COUNT;
+    timer_stop(TIMER_SEQUENCE + BRIDGE_CH(ch));
+    run(ch);
+}
+
+
+void sequence_jump(uint8_t ch, enum output_config cfg)
+{
+    struct sequence_channel *c = CHANNEL(ch);
+
+    timer_stop(TIMER_SEQUENCE + BRIDGE_CH(ch));
+    c->steps_left = 0;
+    c->target = cfg;
+    set_outputs(ch, cfg);
+}
+
+
+bool sequence_running(uint8_t ch)
+{
+    return CHANNEL(ch)->steps_left != 0;
+}
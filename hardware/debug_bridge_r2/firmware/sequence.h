@@ -0,0 +1,85 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+/// @file sequence.h
+/// Break-before-make output sequencing for mode changes.
+///
+/// set_outputs() switches every output at once, so the PixC and the hubs can
+/// see the new data path with the old power and CC pulls, or the other way
+/// round. A sequence instead takes the outputs to a configuration in steps,
+/// with a delay after each:
+///
+///  1. charging and hub vbus detect off       SEQUENCE_BREAK_MS
+///  2. CC pulls open                          SEQUENCE_OPEN_CC_MS
+///  3. USB mux and LEDs to the new config     SEQUENCE_MUX_MS
+///  4. CC pulls and hub vbus detect, then charging, to the new config
+///
+/// Only the groups whose pins differ between the old and new configuration
+/// are switched, and a step with none of them is skipped along with its
+/// delay. A change of LEDs alone, such as idle to host, just writes the mux
+/// group: opening the CC pulls would look like a detach to the PixC, which
+/// would drop its vbus and change the mode again.
+///
+/// Each bridge channel runs its own sequence, with its own TIMER_SEQUENCE
+/// slot.
+///
+/// Steps run from TIMER_SEQUENCE, so nothing blocks. Starting a sequence for
+/// another configuration aborts the one under way and starts over from the
+/// break, which is safe from any step. The hub reset is left to the caller,
+/// which releases it once the sequence is done.
+
+#ifndef _SEQUENCE_H
+#define _SEQUENCE_H 1
+
+#include "hardware.h"
+#include "timer.h"
+
+#include <stdbool.h>
+
+/// Step delays in ms. The break lets the charging switch turn fully off. The
+/// CC pulls stay open for the longest a Type-C port may debounce a detach
+/// (tPDDebounce, 20 ms), so the PixC always sees the old role end. The mux
+/// settles in microseconds; one tick is the shortest delay there is.
+#define SEQUENCE_BREAK_MS   2u
+#define SEQUENCE_OPEN_CC_MS 20u
+#define SEQUENCE_MUX_MS     1u
+
+/// Sequence completion callback, passed the bridge channel
+typedef void (*sequence_fn)(uint8_t ch);
+
+/// Take a channel's outputs to a configuration in steps. If a sequence for
+/// the same configuration is under way it carries on, only taking the new
+/// callback; one for another configuration is aborted. If the outputs are
+/// already there, done is called at once.
+/// @param done - called from the last step; may start another sequence
+void sequence_start(uint8_t ch, enum output_config cfg, sequence_fn done);
+
+/// Switch a channel's outputs to a configuration at once, aborting any
+/// sequence. For changes nothing can see yet, such as behind the power-on hub
+/// reset.
+void sequence_jump(uint8_t ch, enum output_config cfg);
+
+/// Return whether a sequence is under way on a channel.
+bool sequence_running(uint8_t ch);
+
+#endif // _SEQUENCE_H
@@ -0,0 +1,120 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+// Write a configuration block image (config.h) for the EEPROM, starting from
+// the compiled-in defaults and applying any name=value overrides given, e.g.
+//
+//     sim/gen_config debounce_detach_ms=20 valid_fall_mv=3800 > config.eep
+//
+// Names are the config_block fields. The image is checked as the firmware
+// would check it; an image the firmware would reject is not written.
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+struct field {
+    const char *name;
+    size_t offset;
+    size_t size;
+};
+
+#define FIELD(f) { #f, offsetof(struct config_block, f), sizeof(((struct config_block *) 0)->f) }
+
+static const struct field fields[] = {
+    FIELD(valid_rise_mv),
+    FIELD(valid_fall_mv),
+    FIELD(diode_enter_min_mv),
+    FIELD(diode_enter_max_mv),
+    FIELD(diode_leave_min_mv),
+    FIELD(diode_leave_max_mv),
+    FIELD(debounce_attach_ms),
+    FIELD(debounce_detach_ms),
+    FIELD(hub_reset_role_swap_ms),
+    FIELD(hub_reset_same_role_ms),
+    FIELD(hub_reset_to_none_ms),
+};
+
+#define N_FIELDS (sizeof fields / sizeof fields[0])
+
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [name=value ...] > config.eep\nfields:\n", argv0);
+    for (size_t i = 0; i < N_FIELDS; ++i)
+        fprintf(stderr, "  %s\n", fields[i].name);
+    exit(2);
+}
+
+
+static void set_field(struct config_block *blk, const char *arg, const char *argv0)
+{
+    const char *eq = strchr(arg, '=');
+    char *end;
+
+    if (!eq)
+        usage(argv0);
+
+    for (size_t i = 0; i < N_FIELDS; ++i) {
+        const struct field *f = &fields[i];
+
+        if (strlen(f->name) != (size_t)(eq - arg) || strncmp(f->name, arg, eq - arg))
+            continue;
+
+        unsigned long val = strtoul(eq + 1, &end, 0);
+        if (*end || eq[1] == '\0' || val >> (8 * f->size)) {
+            fprintf(stderr, "%s: bad value\n", arg);
+            exit(2);
+        }
+
+        // Both the host and the AVR are little-endian
+        uint8_t *p = (uint8_t *) blk + f->offset;
+        for (size_t b = 0; b < f->size; ++b)
+            p[b] = val >> (8 * b);
+        return;
+    }
+
+    fprintf(stderr, "%s: unknown field\n", arg);
+    usage(argv0);
+}
+
+
+int main(int argc, char **argv)
+{
+    struct config_block blk;
+
+    config_block_defaults(&blk);
+    for (int i = 1; i < argc; ++i)
+        set_field(&blk, argv[i], argv[0]);
+    blk.crc = config_block_crc(&blk);
+
+    if (!config_block_valid(&blk)) {
+        fprintf(stderr, "%s: inconsistent configuration, no image written\n", argv[0]);
+        return 1;
+    }
+
+    fwrite(&blk, sizeof blk, 1, stdout);
+    return 0;
+}
@@ -0,0 +1,93 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+// Generate vbus_lut.h, the level table for the VBUS_LUT classifier, and check
+// that the table classifier agrees with the reference for every input: all
+// states, both charging settings, every pair of 8-bit samples. Prints the
+// table on stdout; exits nonzero without printing it on any mismatch.
+//
+// Usage: sim/gen_vbus_lut > vbus_lut.h
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define VBUS_LUT_READ(addr) (*(addr))
+#include "vbus_classify.h"
+
+static uint8_t lut[256];
+static const struct vbus_thresholds thresholds = VBUS_THRESHOLDS_DEFAULT;
+
+
+static unsigned check(void)
+{
+    unsigned mismatches = 0;
+
+    for (unsigned state = 0; state < 8; ++state) {
+        for (unsigned charging = 0; charging < 2; ++charging) {
+            for (unsigned p = 0; p < 256; ++p) {
+                for (unsigned d = 0; d < 256; ++d) {
+                    uint8_t ref = vbus_classify(&thresholds, state, p, d, charging);
+                    uint8_t got = vbus_classify_lut(lut, state, p, d, charging);
+
+                    if (ref != got && mismatches++ < 10) {
+                        fprintf(stderr, "state %u charging %u pixc %u dbg %u: "
+                                "reference %u, table %u\n",
+                                state, charging, p, d, ref, got);
+                    }
+                }
+            }
+        }
+    }
+
+    return mismatches;
+}
+
+
+int main(void)
+{
+    for (unsigned i = 0; i < 256; ++i)
+        lut[i] = vbus_level(i);
+
+    unsigned mismatches = check();
+    if (mismatches) {
+        fprintf(stderr, "gen_vbus_lut: %u mismatches, no table written\n", mismatches);
+        return 1;
+    }
+
+    printf("// Generated by sim/gen_vbus_lut from the thresholds in vbus_classify.h.\n"
+           "// Do not edit.\n\n"
+           "#ifndef _VBUS_LUT_H\n"
+           "#define _VBUS_LUT_H 1\n\n"
+           "#include <avr/pgmspace.h>\n"
+           "#include <inttypes.h>\n\n"
+           "// RISE %u, FALL %u, ENTER %u..%u, LEAVE %u..%u\n"
+           "static const uint8_t vbus_level_lut[256] PROGMEM = {\n",
+           VBUS_VALID_RISE, VBUS_VALID_FALL, DIODE_ENTER_MIN, DIODE_ENTER_MAX,
+           DIODE_LEAVE_MIN, DIODE_LEAVE_MAX);
+
+    for (unsigned i = 0; i < 256; ++i) {
+        printf("%s0x%02x,%s", (i % 16) ? " " : "    ", lut[i], (i % 16 == 15) ? "\n" : "");
+    }
+
+    printf("};\n\n#endif // _VBUS_LUT_H\n");
+    return 0;
+}
@@ -0,0 +1,613 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "hardware.h"
+#include "adc_filter.h"
+#include "adc_plan.h"
+#include "adc_queue.h"
+#include "trip.h"
+#include "sim.h"
+#include "twi_target.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct sim_outputs sim_out[BRIDGE_COUNT];
+
+static bool interrupts_enabled = false;
+static uint32_t now_us = 0;
+static uint32_t next_pair_us = 0;
+static uint32_t next_conversion_us = SIM_DEFAULT_PAIR_US / 2u;
+static uint32_t pair_period_us = SIM_DEFAULT_PAIR_US;
+static uint32_t sample_count = 0;
+static uint32_t conversion_count = 0;
+static bool done = false;
+
+// Current trace pair, what the ADC sees until the next one is due
+static uint16_t input_pixc, input_dbg;
+
+static struct trip_state trip[BRIDGE_COUNT];
+static uint8_t charge_fault[BRIDGE_COUNT];
+static enum output_config applied_outputs[BRIDGE_COUNT];
+
+static uint8_t eeprom[SIM_EEPROM_SIZE];
+static bool eeprom_loaded = false;
+
+static double vcc = ADC_VCC_NOMINAL;
+#if ADC_BANDGAP_PERIOD
+static uint16_t bandgap_raw = 0;
+static bool bandgap_new = false;
+static uint8_t bandgap_countdown = ADC_BANDGAP_PERIOD;
+static bool bandgap_first = true;
+#endif
+
+static uint8_t adc_plan_next[BRIDGE_COUNT];
+static bool adc_scan_idle = false;
+static struct adc_sequencer seq;
+static uint8_t bridge = 0;      // Channel of the frame under way
+
+static enum clock_step clock_step = CLOCK_FULL;
+static bool clock_slow_allowed = false;
+static uint32_t slow_since_us = 0;
+static uint32_t slow_total_us = 0;
+
+static sim_source_fn source = NULL;
+static sim_observer_fn observer = NULL;
+static struct adc_queue adc_queue;
+static struct adc_decimator decimator;
+#ifdef STATS
+static uint16_t adc_queue_stamp;
+#endif
+#ifdef TWI_TARGET
+static struct twi_target twi;
+#endif
+
+
+void sim_set_source(sim_source_fn fn)
+{
+    source = fn;
+}
+
+
+void sim_set_observer(sim_observer_fn fn)
+{
+    observer = fn;
+}
+
+
+void sim_set_pair_period_us(uint32_t us)
+{
+    pair_period_us = us;
+    next_pair_us = now_us;
+    next_conversion_us = now_us + us / 2u;
+}
+
+
+void sim_load_eeprom(const void *data, size_t n)
+{
+    memset(eeprom, 0xff, sizeof eeprom);
+    if (data)
+        memcpy(eeprom, data, (n < sizeof eeprom) ? n : sizeof eeprom);
+    eeprom_loaded = true;
+}
+
+
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+    size_t addr = (size_t) src;
+
+    if (!eeprom_loaded)
+        sim_load_eeprom(NULL, 0);
+
+    for (size_t i = 0; i < n; ++i) {
+        ((uint8_t *) dst)[i] = (addr + i < sizeof eeprom) ? eeprom[addr + i] : 0xff;
+    }
+}
+
+
+void sim_set_vcc(double volts)
+{
+    vcc = volts;
+}
+
+
+// Turn a conversion at the nominal supply into one at the simulated supply
+static uint16_t at_vcc(uint16_t raw)
+{
+    double val = raw * ADC_VCC_NOMINAL / vcc + 0.5;
+
+    return (val > 1023.0) ? 1023u : (uint16_t) val;
+}
+
+
+// Length of a conversion slot at the clock step in effect. The slow step
+// stretches it, as hardware.c does with Timer1.
+static uint32_t slot_us(void)
+{
+    uint32_t us = pair_period_us / 2u;
+
+    return (clock_step == CLOCK_SLOW) ? us * ADC_SCAN_FACTOR : us;
+}
+
+
+static void switch_clock(enum clock_step step)
+{
+    if (step == CLOCK_SLOW)
+        slow_since_us = now_us;
+    else
+        slow_total_us += now_us - slow_since_us;
+    clock_step = step;
+}
+
+
+// As on the board, the next conversion comes a full-speed slot from now.
+static void leave_slow_clock(void)
+{
+    if (clock_step != CLOCK_SLOW)
+        return;
+
+    switch_clock(CLOCK_FULL);
+    next_conversion_us = now_us + slot_us();
+}
+
+
+#if ADC_BANDGAP_PERIOD
+// Convert the bandgap. It takes the next two conversion slots.
+static void take_bandgap(void)
+{
+    bandgap_raw = (uint16_t)(1024.0 * ADC_BANDGAP_VOLTS / vcc + 0.5);
+    bandgap_new = true;
+    next_conversion_us += 2u * slot_us();
+}
+#endif
+
+
+// One conversion of the sequence, as the ADC interrupt would take it.
+// Return the number of slots until the next. Every channel sees the same trace.
+static uint8_t convert(void)
+{
+    struct sim_outputs *out = &sim_out[bridge];
+    bool is_dbg = adc_sequencer_dbg(&seq);
+    uint16_t value = at_vcc(is_dbg ? input_dbg : input_pixc);
+    uint8_t gap;
+
+#ifdef VBUS_LUT
+    // Traces hold 10-bit conversions; the firmware reads only ADCH
+    value >>= 2;
+#endif
+
+    if (is_dbg && trip_check_conversion(value, out->charge) != TRIP_NONE) {
+        out->charge = false;
+        charge_fault[bridge] = TRIP_FLOOR_HIT;
+    }
+    adc_accumulate(&decimator, is_dbg, value, adc_plan_weight(seq.plan, is_dbg));
+
+    adc_scan_idle = false;
+    if (!adc_sequencer_next(&seq, &gap))
+        return gap;
+
+    uint16_t pixc, dbg;
+    adc_decimate(&decimator, &pixc, &dbg);
+
+    uint8_t reason = trip_check(&trip[bridge], dbg, out->charge);
+    if (reason != TRIP_NONE) {
+        out->charge = false;
+        charge_fault[bridge] = reason;
+    }
+
+#ifdef STATS
+    if (!adc_queue_pending(&adc_queue))
+        adc_queue_stamp = get_stamp();
+#endif
+    adc_queue_push(&adc_queue, bridge, pixc, dbg);
+    adc_scan_idle = seq.plan & ADC_PLAN_SCAN;
+    if (++bridge == BRIDGE_COUNT)
+        bridge = 0;
+    seq.plan = adc_plan_next[bridge];
+    if (clock_slow_allowed && adc_scan_idle && (seq.plan & ADC_PLAN_SCAN)) {
+        switch_clock(CLOCK_SLOW);
+        gap = (gap + ADC_SCAN_FACTOR - 1u) / ADC_SCAN_FACTOR;
+        adc_scan_idle = false;
+    }
+    if (clock_step == CLOCK_SLOW)
+        seq.plan &= ~ADC_PLAN_SCAN;
+#if ADC_BANDGAP_PERIOD
+    if (--bandgap_countdown == 0) {
+        bandgap_countdown = ADC_BANDGAP_PERIOD;
+        take_bandgap();
+    }
+#endif
+    return gap;
+}
+
+
+bool sim_step(void)
+{
+    if (done || !source) {
+        done = true;
+        return false;
+    }
+
+#if ADC_BANDGAP_PERIOD
+    // The ADC measures the bandgap before the first pair
+    if (bandgap_first) {
+        bandgap_first = false;
+        take_bandgap();
+    }
+#endif
+
+    now_us = next_conversion_us;
+
+    // Take every trace pair that has come due; the ADC sees the latest
+    while ((int32_t)(next_pair_us - now_us) <= 0) {
+        if (!source(&input_pixc, &input_dbg)) {
+            done = true;
+            return false;
+        }
+        next_pair_us += pair_period_us;
+        ++sample_count;
+    }
+
+    // Conversions that complete with interrupts off are simply lost; the real
+    // ISR would restart from the next one.
+    uint8_t gap = 1;
+    if (interrupts_enabled) {
+        gap = convert();
+        ++conversion_count;
+    }
+    next_conversion_us += gap * slot_us();
+
+    if (observer)
+        observer(SIM_EV_SAMPLE);
+
+    return true;
+}
+
+
+void sim_delay_us(uint32_t us)
+{
+    uint32_t end = now_us + us;
+
+    while (!done && (int32_t)(next_conversion_us - end) <= 0) {
+        sim_step();
+    }
+
+    now_us = end;
+}
+
+
+uint32_t sim_time_us(void)
+{
+    return now_us;
+}
+
+
+uint32_t sim_sample_count(void)
+{
+    return sample_count;
+}
+
+
+uint32_t sim_conversion_count(void)
+{
+    return conversion_count;
+}
+
+
+uint32_t sim_slow_clock_us(void)
+{
+    return slow_total_us + ((clock_step == CLOCK_SLOW) ? now_us - slow_since_us : 0u);
+}
+
+
+bool sim_done(void)
+{
+    return done;
+}
+
+
+void sim_set_interrupts(bool enabled)
+{
+    interrupts_enabled = enabled;
+}
+
+
+void init_ports(void)
+{
+    for (uint8_t ch = 0; ch < BRIDGE_COUNT; ++ch) {
+        sim_out[ch] = (struct sim_outputs) {
+            .leds = SIM_LEDS_OFF,
+            .charge = false,
+            .cc1 = CC_OPEN,
+            .cc2 = CC_OPEN,
+            .usbmux_debug = false,
+            .hub_reset = true,
+            .hub1_vbus = false,
+            .hub2_vbus = false,
+        };
+        applied_outputs[ch] = OUTPUTS_IDLE;
+    }
+}
+
+
+void init_tick_timer(void)
+{
+}
+
+
+void init_power(void)
+{
+}
+
+
+uint16_t get_ticks(void)
+{
+    return (uint16_t)(now_us / 1000u);
+}
+
+
+uint16_t get_stamp(void)
+{
+    return (uint16_t)(now_us / STAMP_US);
+}
+
+
+// Sleeping means waiting for the next conversion or 1 ms tick, the only
+// simulated interrupts.
+void sleep_until_interrupt(void)
+{
+    uint32_t tick_us = (now_us / 1000u + 1u) * 1000u;
+
+    if (observer)
+        observer(SIM_EV_SLEEP);
+
+    interrupts_enabled = true;
+    if (!done && (int32_t)(next_conversion_us - tick_us) > 0)
+        now_us = tick_us;
+    else
+        sim_step();
+}
+
+
+void init_adc(void)
+{
+}
+
+
+bool get_adc_sample(uint8_t *ch, uint16_t *pixc, uint16_t *dbg)
+{
+    return adc_queue_pop(&adc_queue, ch, pixc, dbg);
+}
+
+
+bool adc_sample_pending(void)
+{
+    return adc_queue_pending(&adc_queue);
+}
+
+
+uint8_t get_adc_overflows(void)
+{
+    return adc_queue.overflows;
+}
+
+
+#ifdef STATS
+uint16_t get_adc_queue_stamp(void)
+{
+    return adc_queue_stamp;
+}
+#endif
+
+
+void set_adc_plan(uint8_t ch, enum adc_plan plan, bool scan)
+{
+    adc_plan_next[ch] = plan | (scan ? ADC_PLAN_SCAN : 0u);
+    if (!scan)
+        leave_slow_clock();
+
+    if (!scan && adc_scan_idle) {
+        uint32_t soon = now_us + pair_period_us / 2u;
+        if ((int32_t)(next_conversion_us - soon) > 0)
+            next_conversion_us = soon;
+    }
+}
+
+
+void set_clock_step(enum clock_step step)
+{
+    clock_slow_allowed = (step == CLOCK_SLOW);
+    if (step == CLOCK_FULL)
+        leave_slow_clock();
+}
+
+
+uint8_t get_charge_fault(uint8_t ch)
+{
+    return charge_fault[ch];
+}
+
+
+void clear_charge_fault(uint8_t ch)
+{
+    charge_fault[ch] = TRIP_NONE;
+    set_output_groups(ch, applied_outputs[ch], OUTPUT_CHARGE);
+}
+
+
+bool get_adc_bandgap(uint16_t *raw)
+{
+#if ADC_BANDGAP_PERIOD
+    bool changed = bandgap_new;
+
+    bandgap_new = false;
+    *raw = bandgap_raw;
+    return changed;
+#else
+    (void) raw;
+    return false;
+#endif
+}
+
+
+void set_outputs(uint8_t ch, enum output_config cfg)
+{
+    set_output_groups(ch, cfg, OUTPUT_ALL);
+}
+
+
+// Set the outputs of some groups to a configuration, ignoring charge faults.
+static void config_outputs(struct sim_outputs *out, enum output_config cfg, uint8_t groups)
+{
+    bool dev = (cfg == OUTPUTS_DEV);
+    bool on = (cfg != OUTPUTS_OFF);
+
+    if (groups & OUTPUT_MUX) {
+        out->leds = (cfg == OUTPUTS_IDLE || cfg == OUTPUTS_OFF) ? SIM_LEDS_OFF : dev ? SIM_LEDS_DEV : SIM_LEDS_HOST;
+        out->usbmux_debug = dev;
+    }
+    if (groups & OUTPUT_CHARGE)
+        out->charge = dev;
+    if (groups & OUTPUT_VBUSDET) {
+        out->hub1_vbus = on && !dev;
+        out->hub2_vbus = dev;
+    }
+    if (groups & OUTPUT_CC) {
+        out->cc1 = on ? CC_DOWN : CC_OPEN;
+        out->cc2 = dev ? CC_DOWN : CC_OPEN;
+    }
+}
+
+
+void set_output_groups(uint8_t ch, enum output_config cfg, uint8_t groups)
+{
+    config_outputs(&sim_out[ch], cfg, groups);
+    if (groups & OUTPUT_CHARGE) {
+        applied_outputs[ch] = cfg;
+        sim_out[ch].charge &= charge_fault[ch] == TRIP_NONE;
+    }
+}
+
+
+uint8_t get_output_changes(uint8_t ch, enum output_config from, enum output_config to)
+{
+    struct sim_outputs a = {0}, b = {0};
+    uint8_t changes = 0;
+
+    (void) ch;
+    config_outputs(&a, from, OUTPUT_ALL);
+    config_outputs(&b, to, OUTPUT_ALL);
+    if (a.leds != b.leds || a.usbmux_debug != b.usbmux_debug)
+        changes |= OUTPUT_MUX;
+    if (a.charge != b.charge)
+        changes |= OUTPUT_CHARGE;
+    if (a.hub1_vbus != b.hub1_vbus || a.hub2_vbus != b.hub2_vbus)
+        changes |= OUTPUT_VBUSDET;
+    if (a.cc1 != b.cc1 || a.cc2 != b.cc2)
+        changes |= OUTPUT_CC;
+    return changes;
+}
+
+
+bool is_charge_enabled(uint8_t ch)
+{
+    return sim_out[ch].charge;
+}
+
+
+void set_hub_reset(uint8_t ch, bool val)
+{
+    sim_out[ch].hub_reset = val;
+}
+
+
+// There is no pin to toggle; traces have the timing already.
+void toggle_marker(void)
+{
+}
+
+
+#ifdef TWI_TARGET
+void init_twi(volatile uint8_t *regs, uint8_t size, uint8_t writable)
+{
+    twi.regs = regs;
+    twi.size = size;
+    twi.writable = writable;
+}
+
+
+bool is_twi_busy(void)
+{
+    return twi_target_busy(&twi);
+}
+
+
+// The controller's side of the bus: each event is what the TWI interrupt
+// would see. The target always acknowledges.
+static void twi_event(uint8_t status, uint8_t *data)
+{
+    uint8_t byte = data ? *data : 0xff;
+
+    twi_target_event(&twi, status, &byte);
+    if (data)
+        *data = byte;
+}
+
+
+void sim_twi_write(uint8_t reg, const uint8_t *data, uint8_t n)
+{
+    twi_event(TW_SR_SLA_ACK, NULL);
+    twi_event(TW_SR_DATA_ACK, &reg);
+    for (uint8_t i = 0; i < n; ++i) {
+        uint8_t byte = data[i];
+        twi_event(TW_SR_DATA_ACK, &byte);
+    }
+    twi_event(TW_SR_STOP, NULL);
+}
+
+
+void sim_twi_read(uint8_t reg, uint8_t *data, uint8_t n)
+{
+    // Pointer write, repeated start, then the read, NACKing the last byte
+    twi_event(TW_SR_SLA_ACK, NULL);
+    twi_event(TW_SR_DATA_ACK, &reg);
+    twi_event(TW_SR_STOP, NULL);
+    twi_event(TW_ST_SLA_ACK, &data[0]);
+    for (uint8_t i = 1; i < n; ++i)
+        twi_event(TW_ST_DATA_ACK, &data[i]);
+    twi_event(TW_ST_DATA_NACK, NULL);
+}
+#endif
+
+
+// Dumps are only ever requested by the replay harness calling trace_dump().
+bool is_dump_requested(void)
+{
+    return false;
+}
+
+
+void dump_putc(char c)
+{
+    if (c != '\r')
+        putchar(c);
+}
@@ -0,0 +1,655 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+// ADC trace replay harness. Feeds (pixc, dbg) sample streams through the real
+// vbus.c and main.c logic on the host simulation backend and reports, for every
+// debounced vbus_mode transition, how long it took to detect and how long until
+// the outputs were applied and the hubs released. That report follows bridge
+// channel 0; with several channels, which all see the same trace, each one's
+// changes are also counted and timed for a summary per channel.
+//
+// Trace format: one segment per line, "<pixc> <dbg> [count]". Values with a
+// decimal point are volts, anything else is a raw 10-bit ADC count. Each pair
+// is one pair of conversions, before oversampling. The pair is
+// repeated count times (default 1). '#' starts a comment.
+
+#include "main.h"
+#include "hardware.h"
+#include "vbus.h"
+#include "sim.h"
+#include "trace.h"
+#include "vcc.h"
+#include "config.h"
+#include "trip.h"
+#include "stats.h"
+#include "telemetry.h"
+
+#include <avr/eeprom.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct segment {
+    uint16_t pixc;
+    uint16_t dbg;
+    uint32_t count;
+};
+
+static struct segment *segments = NULL;
+static size_t n_segments = 0;
+
+static size_t seg_index = 0;
+static uint32_t seg_remaining = 0;
+static int noise_lsb = 0;
+static bool quiet = false;
+static bool dump_trace = false;
+
+// Sample number of the first sample after the most recent change in input
+static uint32_t input_change_sample = 1;
+
+static enum vbus_mode seen_mode = VBUS_WAIT;
+static uint32_t commit_sample = 0;
+static uint32_t commit_us = 0;
+static enum vbus_mode commit_from = VBUS_WAIT;
+static bool apply_pending = false;
+static uint32_t applied_us = 0;
+static bool applied_unseen = false;     // By the TWI test host
+
+// Every bridge channel, tracked only as far as the summary per channel needs
+static struct {
+    enum vbus_mode seen_mode;
+    uint32_t commit_us;
+    bool apply_pending;
+    uint32_t changes;
+    uint32_t applied;
+    uint32_t max_apply_us;
+} channels[BRIDGE_COUNT];
+
+// Time to enumeration: from power-on to the first hub release
+static uint32_t boot_us = 0;
+static enum vbus_mode boot_mode = VBUS_WAIT;
+
+#define N_MODES VBUS_MODE_COUNT
+
+struct transition_stats {
+    uint32_t count;
+    uint32_t min_samples;
+    uint32_t max_samples;
+    uint64_t sum_samples;
+    uint32_t applied;
+    uint32_t max_apply_us;
+};
+
+static struct transition_stats stats[N_MODES][N_MODES];
+static uint32_t pair_us = SIM_DEFAULT_PAIR_US;
+
+static const char *const mode_names[N_MODES] = {
+    [VBUS_WAIT]         = "WAIT",
+    [VBUS_NONE]         = "NONE",
+    [VBUS_PIXC_ONLY]    = "PIXC_ONLY",
+    [VBUS_DEBUG_ONLY]   = "DEBUG_ONLY",
+    [VBUS_BOTH]         = "BOTH",
+    [VBUS_BOTH_DIODE]   = "BOTH_DIODE",
+};
+
+
+static bool parse_value(const char *tok, uint16_t *out)
+{
+    char *end;
+
+    if (strchr(tok, '.')) {
+        double v = strtod(tok, &end);
+        if (*end || v < 0.0)
+            return false;
+        *out = (v >= 6.6) ? 0x3ffu : ADC_RAW_VAL(v);
+    } else {
+        unsigned long v = strtoul(tok, &end, 0);
+        if (*end || v > 0x3ffu)
+            return false;
+        *out = (uint16_t) v;
+    }
+
+    return true;
+}
+
+
+static void load_trace(FILE *f, const char *name)
+{
+    char line[256];
+    unsigned lineno = 0;
+
+    while (fgets(line, sizeof line, f)) {
+        ++lineno;
+
+        char *hash = strchr(line, '#');
+        if (hash)
+            *hash = 0;
+
+        char *tok[3];
+        int ntok = 0;
+        for (char *t = strtok(line, " \t\r\n,"); t; t = strtok(NULL, " \t\r\n,")) {
+            if (ntok == 3) {
+                ntok = -1;
+                break;
+            }
+            tok[ntok++] = t;
+        }
+
+        if (ntok == 0)
+            continue;
+
+        struct segment seg = { .count = 1 };
+        if (ntok < 2 || !parse_value(tok[0], &seg.pixc) || !parse_value(tok[1], &seg.dbg)) {
+            fprintf(stderr, "%s:%u: bad sample line\n", name, lineno);
+            exit(2);
+        }
+        if (ntok == 3) {
+            char *end;
+            seg.count = strtoul(tok[2], &end, 0);
+            if (*end || !seg.count) {
+                fprintf(stderr, "%s:%u: bad repeat count\n", name, lineno);
+                exit(2);
+            }
+        }
+
+        segments = realloc(segments, (n_segments + 1) * sizeof *segments);
+        if (!segments) {
+            perror("realloc");
+            exit(2);
+        }
+        segments[n_segments++] = seg;
+    }
+}
+
+
+static uint16_t add_noise(uint16_t val)
+{
+    if (!noise_lsb)
+        return val;
+
+    int v = (int) val + (rand() % (2 * noise_lsb + 1)) - noise_lsb;
+    if (v < 0)
+        v = 0;
+    if (v > 0x3ff)
+        v = 0x3ff;
+    return (uint16_t) v;
+}
+
+
+static bool trace_source(uint16_t *pixc, uint16_t *dbg)
+{
+    if (!seg_remaining) {
+        if (seg_index == n_segments)
+            return false;
+
+        const struct segment *seg = &segments[seg_index];
+        if (!seg_index || seg->pixc != seg[-1].pixc || seg->dbg != seg[-1].dbg)
+            input_change_sample = sim_sample_count() + 1;
+
+        seg_remaining = seg->count;
+        ++seg_index;
+    }
+
+    const struct segment *seg = &segments[seg_index - 1];
+    --seg_remaining;
+    *pixc = add_noise(seg->pixc);
+    *dbg = add_noise(seg->dbg);
+    return true;
+}
+
+
+// Whether the outputs reflect the given mode and the hubs are out of reset.
+// Only checked when the main loop goes to sleep, so a mode counts as applied
+// once the main loop has acted on it.
+static bool outputs_applied(uint8_t ch, enum vbus_mode mode)
+{
+    bool dev = (mode == VBUS_DEBUG_ONLY || mode == VBUS_BOTH);
+
+    return !sim_out[ch].hub_reset &&
+           sim_out[ch].usbmux_debug == dev &&
+           sim_out[ch].charge == (dev && get_charge_fault(ch) == TRIP_NONE);
+}
+
+
+// Report the fast charge trip latching and clearing.
+static void check_trip(void)
+{
+    static const char *const reasons[] = {
+        [TRIP_FLOOR_HIT] = "below the floor",
+        [TRIP_SLOPE_HIT] = "falling too fast",
+    };
+    static uint8_t seen_fault = TRIP_NONE;
+    uint8_t fault = get_charge_fault(0);
+
+    if (fault == seen_fault || quiet) {
+        seen_fault = fault;
+        return;
+    }
+
+    if (fault != TRIP_NONE)
+        printf("%10.3f ms  sample %7u  charging tripped, debug vbus %s\n",
+               sim_time_us() / 1000.0, sim_sample_count(), reasons[fault]);
+    else
+        printf("%10.3f ms  sample %7u  charge trip cleared\n",
+               sim_time_us() / 1000.0, sim_sample_count());
+    seen_fault = fault;
+}
+
+
+static void check_applied(void)
+{
+    if (!apply_pending || !outputs_applied(0, seen_mode))
+        return;
+
+    apply_pending = false;
+    applied_us = sim_time_us();
+    applied_unseen = true;
+
+    uint32_t apply_us = sim_time_us() - commit_us;
+    struct transition_stats *st = &stats[commit_from][seen_mode];
+    if (apply_us > st->max_apply_us)
+        st->max_apply_us = apply_us;
+    ++st->applied;
+
+    if (!quiet)
+        printf("%10.3f ms  sample %7u  outputs applied, %.3f ms after commit\n",
+               sim_time_us() / 1000.0, commit_sample, apply_us / 1000.0);
+}
+
+
+// Samples are queued by the simulated interrupt and classified by the main
+// loop, so a new mode shows up by the time the main loop next sleeps. Sample
+// counts are unaffected: no pair is delivered in between.
+static void check_committed(void)
+{
+    enum vbus_mode mode = get_current_vbus_mode(0);
+
+    if (mode != seen_mode) {
+        uint32_t sample = sim_sample_count();
+        uint32_t latency = sample - input_change_sample + 1;
+        struct transition_stats *st = &stats[seen_mode][mode];
+
+        if (!quiet)
+            printf("%10.3f ms  sample %7u  %s -> %s, detected after %u samples (%.3f ms)\n",
+                   sim_time_us() / 1000.0, sample, mode_names[seen_mode], mode_names[mode],
+                   latency, latency * pair_us / 1000.0);
+
+        if (!st->count || latency < st->min_samples)
+            st->min_samples = latency;
+        if (latency > st->max_samples)
+            st->max_samples = latency;
+        st->sum_samples += latency;
+        ++st->count;
+
+        if (apply_pending && !quiet)
+            printf("%10.3f ms  sample %7u  %s superseded before it was applied\n",
+                   sim_time_us() / 1000.0, sample, mode_names[seen_mode]);
+
+        commit_from = seen_mode;
+        seen_mode = mode;
+        commit_sample = sample;
+        commit_us = sim_time_us();
+        apply_pending = true;
+    }
+}
+
+
+static void check_channels(void)
+{
+    for (uint8_t ch = 0; ch < BRIDGE_COUNT; ++ch) {
+        enum vbus_mode mode = get_current_vbus_mode(ch);
+
+        if (mode != channels[ch].seen_mode) {
+            channels[ch].seen_mode = mode;
+            channels[ch].commit_us = sim_time_us();
+            channels[ch].apply_pending = true;
+            ++channels[ch].changes;
+        }
+
+        if (channels[ch].apply_pending && outputs_applied(ch, mode)) {
+            uint32_t apply_us = sim_time_us() - channels[ch].commit_us;
+
+            channels[ch].apply_pending = false;
+            ++channels[ch].applied;
+            if (apply_us > channels[ch].max_apply_us)
+                channels[ch].max_apply_us = apply_us;
+        }
+    }
+}
+
+
+static void observe(enum sim_event ev)
+{
+    if (ev == SIM_EV_SLEEP) {
+        check_trip();
+        check_committed();
+        check_applied();
+        if (BRIDGE_COUNT > 1)
+            check_channels();
+
+        if (boot_mode == VBUS_WAIT && !sim_out[0].hub_reset) {
+            boot_mode = seen_mode;
+            boot_us = sim_time_us();
+        }
+    }
+}
+
+
+#ifdef TWI_TARGET
+// Test host on the simulated TWI bus: polls SEQ and times each change it sees
+// from the outputs being applied, and writes FORCE at set times.
+static uint32_t host_poll_us = 0;
+static uint32_t host_next_poll_us = 0;
+static uint8_t host_seq = 0;
+static uint32_t host_changes = 0;
+static uint32_t host_max_latency_us = 0;
+
+#define MAX_FORCES 8
+
+static struct {
+    uint32_t at_us;
+    uint8_t mode;
+} forces[MAX_FORCES];
+static unsigned n_forces = 0;
+static unsigned next_force = 0;
+
+
+// Parse "<ms>=<mode>", the mode by name or "off".
+static bool parse_force(const char *arg)
+{
+    char *end;
+    unsigned long ms = strtoul(arg, &end, 0);
+
+    if (*end != '=' || n_forces == MAX_FORCES)
+        return false;
+
+    uint8_t mode = TELEMETRY_FORCE_OFF;
+    if (strcmp(end + 1, "off")) {
+        for (mode = VBUS_NONE; mode < N_MODES; ++mode) {
+            if (!strcmp(end + 1, mode_names[mode]))
+                break;
+        }
+        if (mode == N_MODES)
+            return false;
+    }
+
+    forces[n_forces].at_us = ms * 1000u;
+    forces[n_forces].mode = mode;
+    ++n_forces;
+    return true;
+}
+
+
+static void host_poll(void)
+{
+    uint32_t now = sim_time_us();
+
+    while (next_force < n_forces && now >= forces[next_force].at_us) {
+        uint8_t mode = forces[next_force].mode;
+
+        if (!quiet)
+            printf("%10.3f ms  host forces %s\n", now / 1000.0,
+                   mode == TELEMETRY_FORCE_OFF ? "off" : mode_names[mode]);
+        sim_twi_write(TELEMETRY_REG(force), &mode, 1);
+        applied_unseen = false;
+        ++next_force;
+    }
+
+    if (!host_poll_us || now < host_next_poll_us)
+        return;
+    host_next_poll_us = now + host_poll_us;
+
+    uint8_t seq;
+    sim_twi_read(TELEMETRY_REG(seq), &seq, 1);
+    if (seq == host_seq)
+        return;
+    host_seq = seq;
+
+    struct telemetry_regs regs;
+    sim_twi_read(0, (uint8_t *) &regs, TELEMETRY_SIZE);
+
+    // The change completes when the hubs are released; the outputs count as
+    // applied from the next time the main loop sleeps, which is no later.
+    // Only sensed changes are timed: the harness does not track the outputs
+    // of a forced mode, so a change made while forced, or by writing FORCE,
+    // takes no latency sample.
+    if (applied_unseen && regs.mode == seen_mode && !(regs.status & TELEMETRY_ST_FORCED)) {
+        uint32_t latency = now - applied_us;
+        if (latency > host_max_latency_us)
+            host_max_latency_us = latency;
+        applied_unseen = false;
+    }
+    ++host_changes;
+
+    if (!quiet)
+        printf("%10.3f ms  host sees seq %u: %s -> %s, status %02x, pixc %u dbg %u\n",
+               now / 1000.0, seq, mode_names[regs.last_mode], mode_names[regs.mode],
+               regs.status, regs.pixc, regs.dbg);
+}
+#endif
+
+
+static void print_summary(void)
+{
+    printf("\n%-24s %6s %8s %8s %8s %10s %10s\n",
+           "transition", "count", "min", "mean", "max", "max ms", "apply ms");
+
+    for (int from = 0; from < N_MODES; ++from) {
+        for (int to = 0; to < N_MODES; ++to) {
+            const struct transition_stats *st = &stats[from][to];
+            if (!st->count)
+                continue;
+
+            char name[32];
+            snprintf(name, sizeof name, "%s->%s", mode_names[from], mode_names[to]);
+            printf("%-24s %6u %8u %8.1f %8u %10.3f", name, st->count,
+                   st->min_samples, (double) st->sum_samples / st->count,
+                   st->max_samples, st->max_samples * pair_us / 1000.0);
+            if (st->applied)
+                printf(" %10.3f\n", st->max_apply_us / 1000.0);
+            else
+                printf(" %10s\n", "-");
+        }
+    }
+}
+
+
+static void load_eeprom(const char *path)
+{
+    uint8_t image[SIM_EEPROM_SIZE];
+    FILE *f = fopen(path, "rb");
+
+    if (!f) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(2);
+    }
+
+    size_t n = fread(image, 1, sizeof image, f);
+    fclose(f);
+    sim_load_eeprom(image, n);
+}
+
+
+// Whether fw_init() will have taken its configuration from the EEPROM
+static bool eeprom_config_valid(void)
+{
+    struct config_block blk;
+
+    eeprom_read_block(&blk, 0, sizeof blk);
+    return config_block_valid(&blk);
+}
+
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [-p pair_us] [-n noise_lsb] [-s seed] [-v vcc] [-e eeprom] [-q] [-d]"
+#ifdef TWI_TARGET
+            " [-i poll_us] [-F ms=mode]"
+#endif
+            " [trace ...]\n"
+            "  -p  sample pair period in microseconds (default %u)\n"
+            "  -n  add uniform noise of +/- this many LSB to every sample\n"
+            "  -s  random seed for -n\n"
+            "  -v  supply voltage; trace values are taken as measured at %.1f V\n"
+            "  -e  EEPROM image to start from, e.g. config.eep\n"
+            "  -q  only print the summary\n"
+            "  -d  dump the firmware's trace ring at the end\n"
+#ifdef TWI_TARGET
+            "  -i  poll the TWI target for mode changes every poll_us\n"
+            "  -F  write FORCE over TWI at ms; mode is a mode name or \"off\"\n"
+#endif
+            "Traces are read from stdin if none are given.\n",
+            argv0, SIM_DEFAULT_PAIR_US, ADC_VCC_NOMINAL);
+    exit(2);
+}
+
+
+int main(int argc, char **argv)
+{
+    int opt;
+
+#ifdef TWI_TARGET
+    static const char optstring[] = "p:n:s:v:e:qdi:F:";
+#else
+    static const char optstring[] = "p:n:s:v:e:qd";
+#endif
+
+    while ((opt = getopt(argc, argv, optstring)) != -1) {
+        switch (opt) {
+        case 'p':
+            pair_us = strtoul(optarg, NULL, 0);
+            if (!pair_us)
+                usage(argv[0]);
+            break;
+        case 'n':
+            noise_lsb = atoi(optarg);
+            break;
+        case 's':
+            srand(strtoul(optarg, NULL, 0));
+            break;
+        case 'v':
+            sim_set_vcc(strtod(optarg, NULL));
+            break;
+        case 'e':
+            load_eeprom(optarg);
+            break;
+        case 'q':
+            quiet = true;
+            break;
+        case 'd':
+            dump_trace = true;
+            break;
+#ifdef TWI_TARGET
+        case 'i':
+            host_poll_us = strtoul(optarg, NULL, 0);
+            break;
+        case 'F':
+            if (!parse_force(optarg))
+                usage(argv[0]);
+            break;
+#endif
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind == argc) {
+        load_trace(stdin, "<stdin>");
+    } else {
+        for (int i = optind; i < argc; ++i) {
+            FILE *f = fopen(argv[i], "r");
+            if (!f) {
+                fprintf(stderr, "%s: %s\n", argv[i], strerror(errno));
+                return 2;
+            }
+            load_trace(f, argv[i]);
+            fclose(f);
+        }
+    }
+
+    sim_set_pair_period_us(pair_us);
+    sim_set_source(trace_source);
+    sim_set_observer(observe);
+
+    fw_init();
+
+    // fw_poll() sleeps until the next sample pair, which advances the simulation.
+    while (!sim_done()) {
+        fw_poll();
+#ifdef TWI_TARGET
+        host_poll();
+#endif
+    }
+
+    if (apply_pending && !quiet)
+        printf("%10.3f ms  trace ended before outputs were applied\n",
+               sim_time_us() / 1000.0);
+
+    print_summary();
+    if (BRIDGE_COUNT > 1) {
+        printf("\n");
+        for (uint8_t ch = 0; ch < BRIDGE_COUNT; ++ch)
+            printf("channel %u: %u changes, %u applied, at most %.3f ms after commit\n",
+                   ch, channels[ch].changes, channels[ch].applied,
+                   channels[ch].max_apply_us / 1000.0);
+    }
+    if (boot_mode != VBUS_WAIT)
+        printf("\nboot: hubs released in %s after %.3f ms\n", mode_names[boot_mode], boot_us / 1000.0);
+    else
+        printf("\nboot: hubs never released\n");
+    printf("sample pairs dropped on a full queue: %u\n", get_adc_overflows());
+    printf("ADC conversions: %u, %.0f per second\n", sim_conversion_count(),
+           sim_conversion_count() * 1e6 / sim_time_us());
+    printf("slow clock: %.1f%% of the time\n", sim_slow_clock_us() * 100.0 / sim_time_us());
+    printf("measured supply: %u mV\n", vcc_get_mv());
+    printf("configuration: %s\n", eeprom_config_valid() ? "EEPROM" : "defaults");
+
+    const struct trip_counters *trips = get_trip_counters();
+    printf("charge trips: %u floor, %u slope, %u retries\n",
+           trips->floor, trips->slope, trips->retries);
+
+#ifdef TWI_TARGET
+    if (host_poll_us)
+        printf("TWI host: %u changes seen, at most %.3f ms after the outputs were applied\n",
+               host_changes, host_max_latency_us / 1000.0);
+#endif
+
+    // The firmware's own statistics print as a dump shows them, so a STATS
+    // build prints them whether or not the trace is asked for.
+#ifdef STATS
+    bool dump_stats = true;
+#else
+    bool dump_stats = false;
+#endif
+
+    if (dump_trace || dump_stats) {
+        printf("\n");
+        if (dump_trace)
+            trace_dump();
+        stats_dump();
+    }
+
+    return 0;
+}
@@ -0,0 +1,112 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+/// @file sim.h
+/// Host simulation backend. hardware_sim.c implements hardware.h on top of the
+/// state below instead of AVR registers, so main.c and vbus.c build unmodified
+/// for the host. Time only moves when conversions complete, or when the firmware
+/// sleeps or delays; each conversion is one simulated ADC interrupt, taking the
+/// channel it converts from the trace pair current at the time. With several
+/// bridge channels, all of them see the same trace.
+
+#ifndef _SIM_H
+#define _SIM_H 1
+
+#include "hardware.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+/// Default trace pair period: two conversion slots, as paced by the ADC
+/// trigger timer.
+#define SIM_DEFAULT_PAIR_US (2000000u / ADC_CONVERSION_HZ)
+
+enum sim_leds { SIM_LEDS_OFF, SIM_LEDS_HOST, SIM_LEDS_DEV };
+
+/// Simulated output pin state of one bridge channel, as last written by the
+/// firmware.
+struct sim_outputs {
+    enum sim_leds leds;
+    bool charge;
+    enum CC_PULL_TYPE cc1;
+    enum CC_PULL_TYPE cc2;
+    bool usbmux_debug;
+    bool hub_reset;
+    bool hub1_vbus;
+    bool hub2_vbus;
+};
+
+extern struct sim_outputs sim_out[BRIDGE_COUNT];
+
+/// Sample source. Store the next pair and return true, or return false when
+/// the stream is exhausted.
+typedef bool (*sim_source_fn)(uint16_t *pixc, uint16_t *dbg);
+
+enum sim_event {
+    SIM_EV_SAMPLE,  ///< A conversion has been handed to the firmware
+    SIM_EV_SLEEP,   ///< The firmware main loop is about to sleep
+};
+
+/// Observer, called on every simulation event.
+typedef void (*sim_observer_fn)(enum sim_event ev);
+
+void sim_set_source(sim_source_fn fn);
+void sim_set_observer(sim_observer_fn fn);
+void sim_set_pair_period_us(uint32_t us);
+
+/// Simulated EEPROM size, as on the ATtiny48
+#define SIM_EEPROM_SIZE 64u
+
+/// Load the simulated EEPROM; anything past n bytes reads as erased.
+void sim_load_eeprom(const void *data, size_t n);
+
+/// Set the simulated supply voltage. Samples from the source are taken as
+/// conversions at ADC_VCC_NOMINAL and rescaled, and the bandgap reads to match.
+void sim_set_vcc(double volts);
+
+/// Advance to and deliver the next conversion. Returns false once the source
+/// is exhausted.
+bool sim_step(void);
+
+/// Advance simulated time, delivering any conversions that fall due.
+void sim_delay_us(uint32_t us);
+
+uint32_t sim_time_us(void);     ///< Simulated time since start
+uint32_t sim_sample_count(void);///< Trace pairs taken from the source so far
+uint32_t sim_conversion_count(void); ///< Conversions delivered so far
+uint32_t sim_slow_clock_us(void);   ///< Simulated time spent at CLOCK_SLOW
+bool sim_done(void);            ///< Whether the source has been exhausted
+
+void sim_set_interrupts(bool enabled);
+
+#ifdef TWI_TARGET
+/// Write registers of the TWI target, as a test host would: one transaction,
+/// the pointer byte then the data. Takes no simulated time.
+void sim_twi_write(uint8_t reg, const uint8_t *data, uint8_t n);
+
+/// Read registers of the TWI target: a pointer write, a repeated start and an
+/// n-byte read (n at least 1). Takes no simulated time.
+void sim_twi_read(uint8_t reg, uint8_t *data, uint8_t n);
+#endif
+
+#endif // _SIM_H
@@ -0,0 +1,229 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+// Host test of the software timers (timer.c), run by make test. timer.c is
+// linked against a stub get_ticks() that the test moves by hand, so each case
+// sets the tick count, polls, and checks which callbacks ran when.
+
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static uint16_t ticks;
+static unsigned failures;
+
+// Expiries seen, by slot: how many, and timer_now() at the last
+static unsigned fired[TIMER_COUNT];
+static uint32_t fired_at[TIMER_COUNT];
+
+// Set by a case for chain() to start a timer, which chains on if it is the
+// same one
+static enum timer_id chain_id;
+static uint16_t chain_delay;
+
+
+uint16_t get_ticks(void)
+{
+    return ticks;
+}
+
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check(int ok, const char *what, int line)
+{
+    if (!ok) {
+        fprintf(stderr, "test_timer.c:%d: failed: %s\n", line, what);
+        ++failures;
+    }
+}
+
+
+static void note(enum timer_id id)
+{
+    ++fired[id];
+    fired_at[id] = timer_now();
+}
+
+
+static void chain(enum timer_id id)
+{
+    note(id);
+    if (chain_delay)
+        timer_start(chain_id, chain_delay, 0, chain_id == id ? &chain : &note);
+}
+
+
+// Advance the tick count by ms, polling every step ms.
+static void run(uint16_t ms, uint16_t step)
+{
+    while (ms) {
+        uint16_t n = ms < step ? ms : step;
+
+        ticks += n;
+        ms -= n;
+        timer_poll();
+    }
+}
+
+
+// Stop every timer and clear the record, keeping the time.
+static void reset(void)
+{
+    for (unsigned id = 0; id < TIMER_COUNT; ++id) {
+        timer_stop(id);
+        fired[id] = 0;
+    }
+    chain_delay = 0;
+}
+
+
+// The 16-bit tick wraps under a running timer and timer_now() carries on.
+static void test_wraparound(void)
+{
+    ticks = 0xfff0u;
+    timer_poll();
+    uint32_t start = timer_now();
+
+    timer_start(TIMER_HUB_RESET, 0x20u, 0, &note);
+    run(0x1fu, 1);
+    CHECK(fired[TIMER_HUB_RESET] == 0);
+    CHECK(ticks == 0x000fu);
+    CHECK(timer_now() == start + 0x1fu);
+
+    run(1, 1);
+    CHECK(fired[TIMER_HUB_RESET] == 1);
+    CHECK(fired_at[TIMER_HUB_RESET] == start + 0x20u);
+    CHECK(!timer_running(TIMER_HUB_RESET));
+
+    // A long poll gap, short of a whole wrap, is still counted in full
+    run(60000u, 60000u);
+    CHECK(timer_now() == start + 0x20u + 60000u);
+    reset();
+}
+
+
+// A periodic timer keeps to its schedule however late the polls come.
+static void test_periodic(void)
+{
+    uint32_t start = timer_now();
+
+    timer_start(TIMER_CHARGE_RETRY, 10, 10, &note);
+    run(1000, 7);
+    CHECK(fired[TIMER_CHARGE_RETRY] == 100);
+
+    // A poll three periods late runs all three expiries, and the next is
+    // still on the original schedule.
+    run(30, 30);
+    CHECK(fired[TIMER_CHARGE_RETRY] == 103);
+    run(9, 9);
+    CHECK(fired[TIMER_CHARGE_RETRY] == 103);
+    run(1, 1);
+    CHECK(fired[TIMER_CHARGE_RETRY] == 104);
+    CHECK(fired_at[TIMER_CHARGE_RETRY] == start + 1040u);
+    CHECK(timer_running(TIMER_CHARGE_RETRY));
+    reset();
+}
+
+
+// Restarting a pending timer moves its expiry; stopping one cancels it and
+// leaves the timers after it in the list on time.
+static void test_restart_stop(void)
+{
+    uint32_t start = timer_now();
+
+    timer_start(TIMER_HUB_RESET, 50, 0, &note);
+    run(20, 1);
+    timer_start(TIMER_HUB_RESET, 50, 0, &note);
+    run(49, 1);
+    CHECK(fired[TIMER_HUB_RESET] == 0);
+    run(1, 1);
+    CHECK(fired[TIMER_HUB_RESET] == 1);
+    CHECK(fired_at[TIMER_HUB_RESET] == start + 70u);
+
+    start = timer_now();
+    timer_start(TIMER_HUB_RESET, 10, 0, &note);
+    timer_start(TIMER_CHARGE_RETRY, 20, 0, &note);
+    timer_start(TIMER_SEQUENCE, 30, 0, &note);
+    run(5, 1);
+    timer_stop(TIMER_CHARGE_RETRY);
+    CHECK(!timer_running(TIMER_CHARGE_RETRY));
+    timer_stop(TIMER_CHARGE_RETRY);
+    run(40, 1);
+    CHECK(fired[TIMER_HUB_RESET] == 2);
+    CHECK(fired_at[TIMER_HUB_RESET] == start + 10u);
+    CHECK(fired[TIMER_CHARGE_RETRY] == 0);
+    CHECK(fired[TIMER_SEQUENCE] == 1);
+    CHECK(fired_at[TIMER_SEQUENCE] == start + 30u);
+    reset();
+}
+
+
+// A callback can start another timer, or its own again; delays count from
+// when it runs.
+static void test_start_from_callback(void)
+{
+    uint32_t start = timer_now();
+
+    chain_id = TIMER_SEQUENCE;
+    chain_delay = 5;
+    timer_start(TIMER_HUB_RESET, 10, 0, &chain);
+    timer_start(TIMER_CHARGE_RETRY, 16, 0, &note);
+    run(12, 12);
+    CHECK(fired[TIMER_HUB_RESET] == 1);
+    CHECK(timer_running(TIMER_SEQUENCE));
+    run(4, 1);
+    CHECK(fired[TIMER_SEQUENCE] == 0);
+    CHECK(fired[TIMER_CHARGE_RETRY] == 1);
+    CHECK(fired_at[TIMER_CHARGE_RETRY] == start + 16u);
+    run(1, 1);
+    CHECK(fired[TIMER_SEQUENCE] == 1);
+    CHECK(fired_at[TIMER_SEQUENCE] == start + 17u);
+    reset();
+
+    start = timer_now();
+    chain_id = TIMER_HUB_RESET;
+    chain_delay = 10;
+    timer_start(TIMER_HUB_RESET, 10, 0, &chain);
+    run(35, 1);
+    CHECK(fired[TIMER_HUB_RESET] == 3);
+    CHECK(fired_at[TIMER_HUB_RESET] == start + 30u);
+    CHECK(timer_running(TIMER_HUB_RESET));
+    reset();
+}
+
+
+int main(void)
+{
+    test_wraparound();
+    test_periodic();
+    test_restart_stop();
+    test_start_from_callback();
+
+    if (failures) {
+        fprintf(stderr, "test_timer: %u checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("test_timer: ok\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,36 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+/// @file util/atomic.h
+/// Host simulation stand-in for avr-libc's atomic block header. The simulation
+/// only delivers samples between calls into the firmware, so every block is
+/// already atomic; ATOMIC_BLOCK just has to run its body once.
+
+#ifndef _SIM_UTIL_ATOMIC_H
+#define _SIM_UTIL_ATOMIC_H 1
+
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_FORCEON      1
+
+#define ATOMIC_BLOCK(type) for (int _sim_atomic = ((void)(type), 1); _sim_atomic; _sim_atomic = 0)
+
+#endif // _SIM_UTIL_ATOMIC_H
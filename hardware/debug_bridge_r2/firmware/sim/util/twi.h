@@ -0,0 +1,46 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+/// @file util/twi.h
+/// Host simulation stand-in for avr-libc's TWI status codes. Only the target
+/// (slave) codes the firmware handles are here.
+
+#ifndef _SIM_UTIL_TWI_H
+#define _SIM_UTIL_TWI_H 1
+
+#define TW_STATUS_MASK          0xf8
+
+#define TW_SR_SLA_ACK           0x60
+#define TW_SR_ARB_LOST_SLA_ACK  0x68
+#define TW_SR_GCALL_ACK         0x70
+#define TW_SR_DATA_ACK          0x80
+#define TW_SR_DATA_NACK         0x88
+#define TW_SR_STOP              0xa0
+#define TW_ST_SLA_ACK           0xa8
+#define TW_ST_ARB_LOST_SLA_ACK  0xb0
+#define TW_ST_DATA_ACK          0xb8
+#define TW_ST_DATA_NACK         0xc0
+#define TW_ST_LAST_DATA         0xc8
+#define TW_BUS_ERROR            0x00
+
+#endif // _SIM_UTIL_TWI_H
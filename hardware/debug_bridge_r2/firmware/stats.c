@@ -0,0 +1,232 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "stats.h"
+#include "hardware.h"
+#include "timer.h"
+#include "trace.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include <util/atomic.h>
+
+#ifdef STATS
+
+// Modes with statistics: all but VBUS_WAIT, indexed from VBUS_NONE.
+#define STATS_MODES     (VBUS_MODE_COUNT - 1u)
+#define STATS_IDX(mode) ((uint8_t) (mode) - 1u)
+
+_Static_assert(VBUS_WAIT == 0, "VBUS_WAIT must come first to be left out");
+
+static struct {
+    uint16_t dwell_s[STATS_MODES];      ///< Time spent in each mode
+    uint8_t transitions[STATS_MODES][STATS_MODES];  ///< Commits, [from][to]
+    uint16_t debounce_resets;   ///< Debounce runs abandoned before committing
+    uint16_t max_sample_wait;   ///< Longest a sample waited for the main loop, STAMP_US units
+    uint16_t max_task_time;     ///< Longest task run bar TASK_DIAG, STAMP_US units
+} stats;
+
+// Start of the second being charged to the current mode, in ms
+static uint32_t dwell_since = 0;
+static bool was_requested = false;
+
+// Next line of a dump under way: 0 is the header, then one per mode and the
+// totals line.
+#define DUMP_IDLE   0xffu
+#define DUMP_LINES  (STATS_MODES + 2u)
+static uint8_t dump_line = DUMP_IDLE;
+
+// Send the next line of a dump under way.
+static void dump_next_line(void);
+
+
+// Saturating increment of a dwell counter
+static void add_second(uint16_t *dwell)
+{
+    if (*dwell != UINT16_MAX) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            ++*dwell;
+        }
+    }
+}
+
+
+// Charge the whole seconds since dwell_since to a mode. At the end of a mode,
+// also charge the part second, rounded to the nearest.
+static void add_dwell(enum vbus_mode mode, bool end)
+{
+    uint32_t now = timer_now();
+
+    if (mode == VBUS_WAIT) {
+        dwell_since = now;
+        return;
+    }
+
+    uint16_t *dwell = &stats.dwell_s[STATS_IDX(mode)];
+
+    // The main loop polls every few ms, so this runs once at most, bar a
+    // change after a long mode.
+    while (now - dwell_since >= 1000u) {
+        dwell_since += 1000u;
+        add_second(dwell);
+    }
+    if (end) {
+        if (now - dwell_since >= 500u)
+            add_second(dwell);
+        dwell_since = now;
+    }
+}
+
+
+static void set_max(uint16_t *max, uint16_t val)
+{
+    if (val > *max) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            *max = val;
+        }
+    }
+}
+
+
+void stats_dwell(enum vbus_mode mode)
+{
+    add_dwell(mode, false);
+}
+
+
+void stats_transition(enum vbus_mode from, enum vbus_mode to)
+{
+    add_dwell(from, true);
+    if (from == VBUS_WAIT)
+        return;
+
+    uint8_t *count = &stats.transitions[STATS_IDX(from)][STATS_IDX(to)];
+
+    if (*count != UINT8_MAX)
+        ++*count;
+}
+
+
+void stats_debounce_reset(void)
+{
+    if (stats.debounce_resets != UINT16_MAX) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            ++stats.debounce_resets;
+        }
+    }
+}
+
+
+void stats_sample_wait(void)
+{
+    if (adc_sample_pending())
+        set_max(&stats.max_sample_wait, get_stamp() - get_adc_queue_stamp());
+}
+
+
+void stats_task_time(uint16_t start)
+{
+    set_max(&stats.max_task_time, get_stamp() - start);
+}
+
+
+void stats_poll(void)
+{
+    bool requested = is_dump_requested();
+
+    if (requested && !was_requested && dump_line == DUMP_IDLE)
+        dump_line = 0;
+    was_requested = requested;
+
+    // The same request dumps the trace; wait for it to finish.
+    if (dump_line != DUMP_IDLE && !trace_dump_busy())
+        dump_next_line();
+}
+
+
+static void put_hex(uint16_t val, int8_t digits)
+{
+    for (int8_t shift = 4 * (digits - 1); shift >= 0; shift -= 4) {
+        uint8_t nibble = (val >> shift) & 0xf;
+        dump_putc(nibble < 10 ? '0' + nibble : 'a' + nibble - 10);
+    }
+}
+
+
+static void put_eol(void)
+{
+    dump_putc('\r');
+    dump_putc('\n');
+}
+
+
+// Each line copies what it prints with interrupts off, so lines are
+// consistent but not the dump as a whole.
+static void dump_next_line(void)
+{
+    uint8_t line = dump_line;
+
+    if (line == 0) {
+        dump_putc('S');
+    } else if (line <= STATS_MODES) {
+        uint8_t from = line - 1u;
+        uint16_t dwell;
+        uint8_t row[STATS_MODES];
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            dwell = stats.dwell_s[from];
+            memcpy(row, stats.transitions[from], sizeof row);
+        }
+        put_hex(dwell, 4);
+        for (uint8_t to = 0; to < STATS_MODES; ++to) {
+            dump_putc(' ');
+            put_hex(row[to], 2);
+        }
+    } else {
+        uint16_t resets, sample_wait, task_time;
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            resets = stats.debounce_resets;
+            sample_wait = stats.max_sample_wait;
+            task_time = stats.max_task_time;
+        }
+        put_hex(resets, 4);
+        dump_putc(' ');
+        put_hex(sample_wait, 4);
+        dump_putc(' ');
+        put_hex(task_time, 4);
+    }
+    put_eol();
+
+    dump_line = ++line < DUMP_LINES ? line : DUMP_IDLE;
+}
+
+
+void stats_dump(void)
+{
+    if (dump_line == DUMP_IDLE)
+        dump_line = 0;
+    while (dump_line != DUMP_IDLE)
+        dump_next_line();
+}
+
+#endif // STATS
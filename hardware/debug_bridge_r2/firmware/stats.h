@@ -0,0 +1,95 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+/// @file stats.h
+/// Runtime statistics, compiled in with STATS (make STATS=1).
+///
+/// Kept: the time in seconds spent in each vbus mode, a matrix of committed
+/// mode changes, debounce runs abandoned before they committed, the longest a
+/// filtered sample waited in the queue for the main loop, and the longest
+/// scheduler task run other than the diagnostics task, whose dump lines would
+/// swamp it. VBUS_WAIT only lasts until the first sample, so it has no dwell,
+/// and the boot commit out of it is not counted. Counters saturate instead of
+/// wrapping; dwell does so after 18 hours. Only the main loop updates them,
+/// each multi-byte field with interrupts off. A trace dump request prints them
+/// after the trace, one line per call of stats_poll().
+///
+/// Cost: 41 bytes of RAM for the block and 6 for bookkeeping, plus 2 in the
+/// ADC driver. Per main loop poll of the queue, a 32-bit subtraction and
+/// compare to charge dwell; per scheduler task run, two timestamps; per sample
+/// that finds the queue empty, one timestamp in the ADC interrupt. To make
+/// room, the Makefile compiles the trace out and halves the sample queue when
+/// STATS is on.
+
+#ifndef _STATS_H
+#define _STATS_H 1
+
+#include "vbus.h"
+#include "hardware.h"
+
+#include <inttypes.h>
+
+#ifdef STATS
+
+/// Charge the time since the last call to the current mode. Call from the
+/// main loop after processing samples.
+void stats_dwell(enum vbus_mode mode);
+
+/// Count a committed mode change, charging the time up to it to the old mode.
+void stats_transition(enum vbus_mode from, enum vbus_mode to);
+
+/// Count a debounce run abandoned because the candidate mode changed.
+void stats_debounce_reset(void);
+
+/// Measure how long the oldest queued sample has waited. Call from the main
+/// loop before draining the queue.
+void stats_sample_wait(void);
+
+/// Start timing a task run; pass the result to stats_task_time() after it.
+#define stats_stamp()   get_stamp()
+void stats_task_time(uint16_t start);
+
+/// Start a dump if requested on the dump port, and send the next line of one
+/// under way once the trace dump is done. Call from the main loop.
+void stats_poll(void);
+
+/// Print the statistics to the dump port: "S", then one hex line per mode from
+/// VBUS_NONE on, with its dwell in seconds and its row of the transition
+/// matrix, then a line with the debounce resets, the longest sample wait and
+/// the longest task run, both in STAMP_US units.
+/// Finishes a dump under way instead, if there is one. Blocks until done.
+void stats_dump(void);
+
+#else
+
+#define stats_dwell(mode)           do { } while (0)
+#define stats_transition(from, to)  do { } while (0)
+#define stats_debounce_reset()      do { } while (0)
+#define stats_sample_wait()         do { } while (0)
+#define stats_stamp()               0u
+#define stats_task_time(start)      do { (void)(start); } while (0)
+#define stats_poll()                do { } while (0)
+#define stats_dump()                do { } while (0)
+
+#endif // STATS
+
+#endif // _STATS_H
@@ -0,0 +1,136 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "telemetry.h"
+#include "hardware.h"
+#include "vbus.h"
+#include "timer.h"
+#include "sched.h"
+
+#include <stdbool.h>
+#include <util/atomic.h>
+
+#ifdef TWI_TARGET
+
+_Static_assert(TELEMETRY_REG(force) >= TELEMETRY_SIZE - 1u, "only FORCE may be writable");
+
+// Served on the bus. The main loop only writes it while the bus is idle.
+static volatile struct telemetry_regs regs = {
+    .id = TELEMETRY_ID,
+    .force = TELEMETRY_FORCE_OFF,
+};
+
+// Main loop copies of everything regs holds that is not read from elsewhere
+static uint8_t mode = VBUS_WAIT;
+static uint8_t last_mode = VBUS_WAIT;
+static uint8_t seq = 0;
+static uint32_t change_ms = 0;
+static bool settling = true;        // Hubs are held in reset from power-on
+static uint16_t samples[4];
+static uint8_t applied_force = TELEMETRY_FORCE_OFF;
+
+
+void telemetry_init(void)
+{
+    init_twi((volatile uint8_t *) &regs, TELEMETRY_SIZE, TELEMETRY_REG(force));
+}
+
+
+void telemetry_sample(uint16_t pixc_raw, uint16_t dbg_raw, uint16_t pixc, uint16_t dbg)
+{
+    samples[0] = pixc_raw;
+    samples[1] = dbg_raw;
+    samples[2] = pixc;
+    samples[3] = dbg;
+}
+
+
+void telemetry_begin(enum vbus_mode from, enum vbus_mode to)
+{
+    last_mode = from;
+    mode = to;
+    settling = true;
+}
+
+
+// Copy the main loop's view into the registers, unless a transaction is under
+// way. Everything is read beforehand, to keep interrupts off only briefly.
+static void refresh(void)
+{
+    uint8_t status = 0;
+
+    if (settling)
+        status |= TELEMETRY_ST_SETTLING;
+    if (is_vbus_mode_provisional(0))
+        status |= TELEMETRY_ST_PROVISIONAL;
+    if (is_charge_enabled(0))
+        status |= TELEMETRY_ST_CHARGING;
+    if (get_charge_fault(0))
+        status |= TELEMETRY_ST_FAULT;
+    if (is_vbus_mode_forced(0))
+        status |= TELEMETRY_ST_FORCED;
+
+    uint8_t vbus = get_current_vbus_mode(0);
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (!is_twi_busy()) {
+            regs.mode = mode;
+            regs.last_mode = last_mode;
+            regs.seq = seq;
+            regs.change_ms = change_ms;
+            regs.vbus = vbus;
+            regs.status = status;
+            regs.pixc_raw = samples[0];
+            regs.dbg_raw = samples[1];
+            regs.pixc = samples[2];
+            regs.dbg = samples[3];
+        }
+    }
+}
+
+
+void telemetry_complete(void)
+{
+    settling = false;
+    change_ms = timer_now();
+    ++seq;
+
+    // A host waiting on SEQ should see it as soon as possible
+    refresh();
+}
+
+
+void telemetry_poll(void)
+{
+    uint8_t force = regs.force;
+
+    if (force != applied_force) {
+        applied_force = force;
+        vbus_force_mode(0, force);
+        sched_post(TASK_MODE);
+    }
+
+    refresh();
+}
+
+#endif // TWI_TARGET
@@ -0,0 +1,120 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+/// @file telemetry.h
+/// Live telemetry and control from a test host over TWI, compiled in with
+/// TWI_TARGET (make TWI=1).
+///
+/// The firmware answers as a TWI target at TWI_ADDRESS and serves the register
+/// map below (see twi_target.h for the protocol). Multi-byte registers are
+/// little-endian. A host waiting for the bridge to switch polls SEQ, one byte,
+/// which counts completed mode changes: outputs applied and hubs out of reset.
+/// Once it moves, MODE tells what the bridge switched to.
+///
+/// Writing a vbus mode to FORCE overrides the debounced mode: it is applied as
+/// if it had been detected, hub reset included, and stays in force until
+/// TELEMETRY_FORCE_OFF (or any value that is not a mode) is written. Sensing
+/// goes on meanwhile, and the fast charge trip still applies.
+///
+/// Registers are refreshed from the main loop on every tick, and at once when a
+/// change completes, but never while a transaction is under way.
+///
+/// Everything here is of bridge channel 0; with several channels, the others
+/// are neither reported nor forced.
+///
+/// The only TWI pins are PC4 (SDA) and PC5 (SCL), and rev2 senses debug vbus on
+/// PC4. TWI_TARGET builds are for boards with that divider moved to PC1
+/// (ADC1), which rev2 leaves unconnected; see pin_io.h. Cost: 42 bytes of RAM,
+/// made room for by compiling the trace out and halving the sample queue.
+/// The TWI needs a CPU clock of at least 16 times SCL, so these builds always
+/// run at the full clock.
+
+#ifndef _TELEMETRY_H
+#define _TELEMETRY_H 1
+
+#include "vbus.h"
+
+#include <stddef.h>
+#include <inttypes.h>
+
+/// Register map
+struct telemetry_regs {
+    uint8_t id;             ///< 0x00 TELEMETRY_ID
+    uint8_t mode;           ///< 0x01 Mode of the latest change, debounced or forced
+    uint8_t last_mode;      ///< 0x02 Mode before it
+    uint8_t seq;            ///< 0x03 Completed mode changes, wrapping
+    uint32_t change_ms;     ///< 0x04 Time the latest change completed, ms since startup
+    uint8_t vbus;           ///< 0x08 Debounced vbus mode, whatever is forced
+    uint8_t status;         ///< 0x09 TELEMETRY_ST_* flags
+    uint16_t pixc_raw;      ///< 0x0a Latest PixC vbus sample, as filtered by the ADC interrupt
+    uint16_t dbg_raw;       ///< 0x0c Latest debug vbus sample, likewise
+    uint16_t pixc;          ///< 0x0e Latest PixC vbus sample, supply-corrected, as classified
+    uint16_t dbg;           ///< 0x10 Latest debug vbus sample, likewise
+    uint8_t force;          ///< 0x12 Forced mode, or TELEMETRY_FORCE_OFF. Writable.
+};
+
+#define TELEMETRY_REG(field)    offsetof(struct telemetry_regs, field)
+#define TELEMETRY_SIZE          (TELEMETRY_REG(force) + 1u)
+
+_Static_assert(TELEMETRY_REG(change_ms) == 0x04 && TELEMETRY_REG(pixc_raw) == 0x0a &&
+               TELEMETRY_REG(force) == 0x12, "telemetry registers must not be padded");
+
+/// Contents of the ID register. Bump on any change to the register map.
+#define TELEMETRY_ID            0xb1u
+
+#define TELEMETRY_FORCE_OFF     0xffu
+
+#define TELEMETRY_ST_SETTLING   0x01u   ///< A change is being applied: hubs in reset
+#define TELEMETRY_ST_PROVISIONAL 0x02u  ///< The boot mode is not confirmed yet
+#define TELEMETRY_ST_CHARGING   0x04u   ///< Charging from the debug port is on
+#define TELEMETRY_ST_FAULT      0x08u   ///< A charge trip is latched
+#define TELEMETRY_ST_FORCED     0x10u   ///< FORCE overrides the debounced mode
+
+#ifdef TWI_TARGET
+
+/// Start answering on the bus.
+void telemetry_init(void);
+
+/// Take the latest sample pair, before and after supply correction.
+void telemetry_sample(uint16_t pixc_raw, uint16_t dbg_raw, uint16_t pixc, uint16_t dbg);
+
+/// Note that the main loop started applying a mode change.
+void telemetry_begin(enum vbus_mode from, enum vbus_mode to);
+
+/// Note that the mode change is complete.
+void telemetry_complete(void);
+
+/// Act on a FORCE write and refresh the registers. Call from the main loop.
+void telemetry_poll(void);
+
+#else
+
+#define telemetry_init()                            do { } while (0)
+#define telemetry_sample(pixc_raw, dbg_raw, pixc, dbg)  do { } while (0)
+#define telemetry_begin(from, to)                   do { } while (0)
+#define telemetry_complete()                        do { } while (0)
+#define telemetry_poll()                            do { } while (0)
+
+#endif // TWI_TARGET
+
+#endif // _TELEMETRY_H
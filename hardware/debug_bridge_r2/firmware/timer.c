@@ -0,0 +1,159 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "timer.h"
+#include "hardware.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define TIMER_END   0xffu
+
+_Static_assert(TIMER_COUNT <= 16, "running only has 16 bits");
+
+static struct {
+    uint16_t delta;     ///< ms after the previous timer in the list, or after base
+    uint8_t next;       ///< Next timer in the list, or TIMER_END
+} timers[TIMER_COUNT];
+
+// Shared by the slots of each range, see timer.h
+static struct {
+    timer_fn fn;
+    uint16_t period;    ///< 0 for one-shot
+} ranges[TIMER_RANGES];
+
+#define RANGE(id)   (&ranges[(id) / BRIDGE_COUNT])
+
+static uint16_t running = 0;        ///< Bit per timer in the list
+static uint8_t head = TIMER_END;    ///< Earliest timer
+static uint32_t base = 0;           ///< Time the head's delta counts from
+static uint32_t now = 0;            ///< Extended tick count, as of the last update
+
+
+// Extend get_ticks() by the time elapsed since the last call.
+static void update_now(void)
+{
+    now += (uint16_t)(get_ticks() - (uint16_t) now);
+}
+
+
+uint32_t timer_now(void)
+{
+    update_now();
+    return now;
+}
+
+
+// Insert a stopped timer so that it expires delay ms after base.
+static void insert(uint8_t id, uint32_t delay)
+{
+    uint8_t *link = &head;
+
+    while (*link != TIMER_END && delay >= timers[*link].delta) {
+        delay -= timers[*link].delta;
+        link = &timers[*link].next;
+    }
+
+    // delay is now under the delta of whatever follows, if anything. At the
+    // end of the list it can only exceed 16 bits by the poll latency; expire
+    // that little bit early rather than wrapping.
+    if (delay > 0xffffu)
+        delay = 0xffffu;
+
+    timers[id].delta = delay;
+    timers[id].next = *link;
+    if (*link != TIMER_END)
+        timers[*link].delta -= delay;
+    *link = id;
+    running |= 1u << id;
+}
+
+
+static void unlink(uint8_t id)
+{
+    uint8_t *link = &head;
+
+    while (*link != id)
+        link = &timers[*link].next;
+
+    *link = timers[id].next;
+    if (*link != TIMER_END)
+        timers[*link].delta += timers[id].delta;
+    running &= ~(1u << id);
+}
+
+
+void timer_start(enum timer_id id, uint16_t delay_ms, uint16_t period_ms, timer_fn fn)
+{
+    update_now();
+
+    if (head == TIMER_END)
+        base = now;
+    if (timer_running(id))
+        unlink(id);
+
+    RANGE(id)->period = period_ms;
+    RANGE(id)->fn = fn;
+
+    // Delays count from now, the list from base. base only lags now while the
+    // head is due but not yet dispatched, so the sum stays small.
+    insert(id, (uint32_t) delay_ms + (now - base));
+}
+
+
+void timer_stop(enum timer_id id)
+{
+    if (timer_running(id))
+        unlink(id);
+}
+
+
+bool timer_running(enum timer_id id)
+{
+    return running & (1u << id);
+}
+
+
+void timer_poll(void)
+{
+    update_now();
+
+    while (head != TIMER_END && now - base >= timers[head].delta) {
+        uint8_t id = head;
+
+        // base becomes this timer's expiry time, so the next delta and a
+        // periodic reschedule both count from when it was due.
+        base += timers[id].delta;
+        head = timers[id].next;
+        running &= ~(1u << id);
+
+        if (RANGE(id)->period)
+            insert(id, RANGE(id)->period);
+        RANGE(id)->fn(id);
+    }
+
+    // Fold the time elapsed since base into the head, which is not due yet,
+    // so base tracks now and a later start never needs a large delay.
+    if (head != TIMER_END)
+        timers[head].delta -= (uint16_t)(now - base);
+    base = now;
+}
@@ -0,0 +1,85 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+/// @file timer.h
+/// Software timers on the 1 kHz tick, dispatched from the main loop.
+///
+/// timer_now() extends the 16-bit get_ticks() to a 32-bit millisecond count.
+/// It only needs timer_poll() to run at least once per 65 s wrap, which the
+/// tick interrupt's own wakeups guarantee.
+///
+/// Timers are a fixed set listed in enum timer_id: ranges of BRIDGE_COUNT
+/// slots, one per bridge channel, each user adding the channel to the first
+/// slot of its range. The slots of a range share one callback and period,
+/// which every start sets, so a channel costs 3 bytes per range. Running
+/// timers are kept in a list sorted by expiry, each storing its delay after
+/// the one before it, so a poll only ever looks at the head of the list.
+/// Starting a timer walks the list, at most TIMER_COUNT entries.
+///
+/// Callbacks run from timer_poll() and may start or stop any timer, including
+/// their own. A periodic timer is rescheduled from its expiry time, not from
+/// when it was dispatched, so a late main loop does not make it drift.
+
+#ifndef _TIMER_H
+#define _TIMER_H 1
+
+#include <stdbool.h>
+#include <inttypes.h>
+#include "hardware.h"
+
+/// Timer slots. Each is the first of BRIDGE_COUNT, one per channel.
+enum timer_id {
+    TIMER_HUB_RESET = 0,                                ///< End of the hub reset pulse
+    TIMER_CHARGE_RETRY = TIMER_HUB_RESET + BRIDGE_COUNT,///< End of the charge trip backoff
+    TIMER_SEQUENCE = TIMER_CHARGE_RETRY + BRIDGE_COUNT, ///< Next step of an output sequence
+    TIMER_COUNT = TIMER_SEQUENCE + BRIDGE_COUNT
+};
+
+/// Number of timer ranges, one per user above
+#define TIMER_RANGES    (TIMER_COUNT / BRIDGE_COUNT)
+
+/// Timer callback, passed the slot that expired, so a callback shared by a
+/// range of slots can tell which channel it is for.
+typedef void (*timer_fn)(enum timer_id id);
+
+/// Return milliseconds since startup. Wraps after 49 days; compare times by
+/// subtraction.
+uint32_t timer_now(void);
+
+/// Start or restart a timer.
+/// @param id - timer slot
+/// @param delay_ms - time until the first expiry; 0 expires on the next poll
+/// @param period_ms - time between later expiries, or 0 for a one-shot
+///     timer; set for the slot's whole range
+/// @param fn - callback, run from timer_poll(); set for the slot's whole range
+void timer_start(enum timer_id id, uint16_t delay_ms, uint16_t period_ms, timer_fn fn);
+
+/// Stop a timer. Does nothing if it is not running.
+void timer_stop(enum timer_id id);
+
+/// Return whether a timer is running.
+bool timer_running(enum timer_id id);
+
+/// Run the callbacks of all timers that have expired. Call from the main loop.
+void timer_poll(void);
+
+#endif // _TIMER_H
@@ -0,0 +1,170 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "trace.h"
+#include "hardware.h"
+
+#include <stdbool.h>
+
+#if TRACE_LEN
+
+#define TRACE_MASK      (TRACE_LEN - 1u)
+#define TRACE_NO_STOP   0xffu
+#define DUMP_IDLE       0xffu
+
+static struct {
+    struct trace_record buf[TRACE_LEN];
+    uint8_t head;       ///< Next record to write; once frozen, a scratch slot
+    uint8_t step;       ///< 1 while capturing, 0 once frozen
+    uint8_t stop_at;    ///< head value at which to freeze, or TRACE_NO_STOP
+    uint16_t ticks;     ///< Tick of the newest captured record
+} trace = {
+    .step = 1,
+    .stop_at = TRACE_NO_STOP,
+};
+
+// Next line of a dump under way: 0 is the header, then one per record. The
+// ring stays frozen until the last line is out.
+static uint8_t dump_line = DUMP_IDLE;
+
+// Freeze the ring and start a dump.
+static void dump_start(void);
+
+// Send the next line of the dump, and re-arm the trace after the last.
+static void dump_next_line(void);
+
+
+static void trace_put(uint16_t a, uint16_t b)
+{
+    struct trace_record *rec = &trace.buf[trace.head];
+
+    rec->a = a;
+    rec->b = b;
+    if (trace.step)
+        trace.ticks = get_ticks();
+
+    trace.head = (trace.head + trace.step) & TRACE_MASK;
+    trace.step = trace.step & (trace.head != trace.stop_at);
+}
+
+
+void trace_sample(uint16_t a, uint16_t b)
+{
+    trace_put(a, b);
+}
+
+
+void trace_arm(void)
+{
+    if (!trace.step && dump_line == DUMP_IDLE) {
+        trace.stop_at = TRACE_NO_STOP;
+        trace.step = 1;
+    }
+}
+
+
+void trace_trigger(void)
+{
+    if (trace.step && trace.stop_at == TRACE_NO_STOP)
+        trace.stop_at = (trace.head + TRACE_POST) & TRACE_MASK;
+}
+
+
+void trace_event(enum trace_event ev, uint8_t mode)
+{
+    trace_put(((uint16_t) TRACE_EVENT << TRACE_MODE_SHIFT) | ev, mode);
+}
+
+
+void trace_poll(void)
+{
+    static bool was_requested = false;
+
+    bool requested = is_dump_requested();
+
+    if (requested && !was_requested && dump_line == DUMP_IDLE)
+        dump_start();
+    was_requested = requested;
+
+    if (dump_line != DUMP_IDLE)
+        dump_next_line();
+}
+
+
+bool trace_dump_busy(void)
+{
+    return dump_line != DUMP_IDLE;
+}
+
+
+static void put_hex16(uint16_t val)
+{
+    for (int8_t shift = 12; shift >= 0; shift -= 4) {
+        uint8_t nibble = (val >> shift) & 0xf;
+        dump_putc(nibble < 10 ? '0' + nibble : 'a' + nibble - 10);
+    }
+}
+
+
+static void dump_start(void)
+{
+    // Freeze the ring while it is read. Frozen, head no longer moves: records
+    // all go to the scratch slot at head, which holds nothing useful and is
+    // skipped.
+    trace.step = 0;
+    dump_line = 0;
+}
+
+
+static void dump_next_line(void)
+{
+    if (dump_line == 0) {
+        dump_putc('T');
+        dump_putc(' ');
+        put_hex16(trace.ticks);
+    } else {
+        const struct trace_record *rec = &trace.buf[(trace.head + dump_line) & TRACE_MASK];
+
+        put_hex16(rec->a);
+        dump_putc(' ');
+        put_hex16(rec->b);
+    }
+    dump_putc('\r');
+    dump_putc('\n');
+
+    if (++dump_line == TRACE_LEN) {
+        dump_line = DUMP_IDLE;
+        trace.stop_at = TRACE_NO_STOP;
+        trace.step = 1;
+    }
+}
+
+
+void trace_dump(void)
+{
+    if (dump_line == DUMP_IDLE)
+        dump_start();
+    while (dump_line != DUMP_IDLE)
+        dump_next_line();
+}
+
+#endif // TRACE_LEN
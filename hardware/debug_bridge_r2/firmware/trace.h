@@ -0,0 +1,131 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+/// @file trace.h
+/// In-RAM trace of ADC samples and mode transitions.
+///
+/// Every filtered sample pair is recorded into a small ring, along with events
+/// from the main loop. A debounced mode change triggers the trace: capture
+/// continues for TRACE_POST more records and then freezes, so the ring holds
+/// the samples leading up to and following that change. The next debounce run
+/// re-arms a frozen trace, so the ring follows the latest change; a run that
+/// is abandoned leaves it capturing until the next change. Commits out of
+/// VBUS_WAIT and confirmations of the boot mode are not changes.
+///
+/// Dumping prints the ring as hex text: a header with the tick of the newest
+/// record, then one record per line, oldest first. Records carry no time of
+/// their own: samples of channel 0 are one sample period apart (2 ms per
+/// bridge channel, longer in the low-rate scan), and events fall between them.
+/// A requested dump goes out one line per call of trace_poll(), so the main
+/// loop never blocks for more than a line (11 characters, 1 ms).
+///
+/// Cost: TRACE_LEN * 4 + 7 bytes of RAM. Recording a sample is a fixed-size
+/// store and a masked index update, cheap enough to do for every sample.
+/// Everything here runs from the main loop.
+
+#ifndef _TRACE_H
+#define _TRACE_H 1
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+/// Number of records in the ring; a power of two, or 0 to compile tracing out.
+/// At most 8: more does not leave the stack room in the ATtiny48's 256 bytes
+/// of SRAM, which the Makefile checks fw.elf against. One slot is the scratch
+/// slot once frozen, so a dump shows TRACE_LEN - 1 records.
+#ifndef TRACE_LEN
+#define TRACE_LEN   8u
+#endif
+
+/// Records captured after the trigger before the trace freezes.
+#define TRACE_POST  (TRACE_LEN / 2u)
+
+/// Field packing. Sample records carry a mode in the top bits of each value:
+/// a = candidate mode | pixc, b = committed mode | dbg. Event records have
+/// TRACE_EVENT in the top bits of a, the event code below it, and the mode in b.
+#define TRACE_MODE_SHIFT    13
+#define TRACE_VALUE_MASK    ((1u << TRACE_MODE_SHIFT) - 1u)
+#define TRACE_EVENT         7u
+
+/// Events logged by the main loop
+enum trace_event {
+    TRACE_EV_APPLY,         ///< Main loop applied a new mode's outputs
+    TRACE_EV_HUB_RESET,     ///< Hubs put into reset
+    TRACE_EV_HUB_RELEASE,   ///< Hubs released from reset; b = bridge channel
+    TRACE_EV_PROVISIONAL,   ///< Main loop applied the provisional boot mode's outputs
+    TRACE_EV_TRIP,          ///< Charging was cut by the fast trip; b = enum trip_reason
+    TRACE_EV_TRIP_RETRY,    ///< Charge trip cleared after its backoff; b = bridge channel
+};
+
+struct trace_record {
+    uint16_t a;
+    uint16_t b;
+};
+
+#if TRACE_LEN
+
+#if TRACE_LEN & (TRACE_LEN - 1)
+#error "TRACE_LEN must be a power of two"
+#endif
+
+#if TRACE_LEN > 8
+#error "TRACE_LEN must be at most 8"
+#endif
+
+/// Record a sample pair.
+void trace_sample(uint16_t a, uint16_t b);
+
+/// Re-arm a frozen trace, unless it is being dumped. Call when a debounce run
+/// starts.
+void trace_arm(void);
+
+/// Trigger the trace, if it is capturing and has not been triggered since it
+/// was last armed. Call on a debounced mode change.
+void trace_trigger(void);
+
+/// Record a main loop event.
+void trace_event(enum trace_event ev, uint8_t mode);
+
+/// Start a dump if requested on the dump port, and send the next line of one
+/// under way. Call from the main loop.
+void trace_poll(void);
+
+/// Return whether a dump is under way.
+bool trace_dump_busy(void);
+
+/// Print the whole ring, oldest first, to the dump port and re-arm the trace.
+/// Finishes a dump under way instead, if there is one. Blocks until done.
+void trace_dump(void);
+
+#else
+
+#define trace_sample(a, b)      do { } while (0)
+#define trace_arm()             do { } while (0)
+#define trace_trigger()         do { } while (0)
+#define trace_event(ev, mode)   do { } while (0)
+#define trace_poll()            do { } while (0)
+#define trace_dump_busy()       false
+#define trace_dump()            do { } while (0)
+
+#endif // TRACE_LEN
+
+#endif // _TRACE_H
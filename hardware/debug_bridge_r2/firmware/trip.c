@@ -0,0 +1,100 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "trip.h"
+#include "hardware.h"
+#include "sched.h"
+#include "timer.h"
+#include "trace.h"
+
+#include <stdbool.h>
+
+// Counters are shared by all channels; the backoff is each channel's own.
+static struct trip_counters counters;
+
+// A channel is latched while its retry timer runs.
+static struct {
+    uint16_t retry_ms;
+    uint32_t last_retry;
+} channels[BRIDGE_COUNT];
+
+// Clear the latch and let charging resume. TIMER_CHARGE_RETRY callback.
+static void retry(enum timer_id id);
+
+
+static void count(uint8_t *counter)
+{
+    if (*counter != 0xff)
+        ++*counter;
+}
+
+
+static void poll_channel(uint8_t ch)
+{
+    if (timer_running(TIMER_CHARGE_RETRY + BRIDGE_CH(ch)))
+        return;
+
+    uint8_t reason = get_charge_fault(ch);
+    if (reason == TRIP_NONE)
+        return;
+
+    count(reason == TRIP_FLOOR_HIT ? &counters.floor : &counters.slope);
+    trace_event(TRACE_EV_TRIP, reason);
+
+    // Charging held long enough since the last retry, or this is the first
+    // trip: a new fault, not the old one coming back.
+    if (timer_now() - channels[ch].last_retry >= TRIP_HEALTHY_MS ||
+            channels[ch].retry_ms == 0)
+        channels[ch].retry_ms = TRIP_RETRY_MIN_MS;
+
+    timer_start(TIMER_CHARGE_RETRY + BRIDGE_CH(ch), channels[ch].retry_ms, 0, &retry);
+    if (channels[ch].retry_ms < TRIP_RETRY_MAX_MS)
+        channels[ch].retry_ms *= 2;
+}
+
+
+void trip_poll(void)
+{
+    for (uint8_t ch = 0; ch < BRIDGE_COUNT; ++ch)
+        poll_channel(ch);
+}
+
+
+static void retry(enum timer_id id)
+{
+    uint8_t ch = BRIDGE_CH(id - TIMER_CHARGE_RETRY);
+
+    channels[ch].last_retry = timer_now();
+    count(&counters.retries);
+    trace_event(TRACE_EV_TRIP_RETRY, ch);
+    clear_charge_fault(ch);
+
+    // The interrupt may trip again before the scheduler next looks, and a
+    // fault that is set both times is no change to it: check now.
+    sched_post(TASK_TRIP);
+}
+
+
+const struct trip_counters *get_trip_counters(void)
+{
+    return &counters;
+}
@@ -0,0 +1,121 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+/// @file trip.h
+/// Fast charge trip: cuts charging from the debug port as soon as its vbus
+/// collapses, without waiting for the vbus mode debounce.
+///
+/// The ADC interrupt runs trip_check() on every filtered sample pair while
+/// charging is on. A debug vbus below TRIP_FLOOR, or one that fell by more
+/// than TRIP_SLOPE since the previous sample, trips it: the interrupt turns
+/// charging off within the same sample period and latches the reason (see
+/// get_charge_fault()). Charging then stays off whatever outputs are set.
+/// The floor is also checked on every raw debug vbus conversion, so with the
+/// debug rail sampled as the critical channel it trips within 0.5 ms.
+///
+/// The main loop side, trip_poll(), counts trips and clears the latch after a
+/// backoff that doubles on every trip, from TRIP_RETRY_MIN_MS to
+/// TRIP_RETRY_MAX_MS, and starts over once charging has held for
+/// TRIP_HEALTHY_MS. None of this touches the debounced vbus mode.
+///
+/// Samples here are not supply-corrected; the thresholds leave room for that.
+
+#ifndef _TRIP_H
+#define _TRIP_H 1
+
+#include "hardware.h"
+
+#include <stdbool.h>
+#include <inttypes.h>
+
+#define TRIP_FLOOR          ADC_VAL(3.5)    ///< Hard floor, well under VBUS_VALID_FALL
+#define TRIP_SLOPE          ADC_VAL(0.5)    ///< Largest drop allowed per sample (2 ms per bridge)
+
+/// TRIP_FLOOR for a single raw conversion (ADC_CONV_BITS wide)
+#define TRIP_FLOOR_CONV     (TRIP_FLOOR >> (ADC_BITS - ADC_CONV_BITS))
+
+/// Samples after charging turns on before the slope check applies, to ride out
+/// the inrush dip. The floor applies at once.
+#define TRIP_BLANK_MS       4u
+#define TRIP_BLANK          ADC_MS_TO_SAMPLES(TRIP_BLANK_MS)
+
+#define TRIP_RETRY_MIN_MS   100u
+#define TRIP_RETRY_MAX_MS   6400u
+#define TRIP_HEALTHY_MS     10000u
+
+/// Trip reasons, as latched by the ADC interrupt
+enum trip_reason {
+    TRIP_NONE,
+    TRIP_FLOOR_HIT,     ///< Debug vbus below TRIP_FLOOR
+    TRIP_SLOPE_HIT,     ///< Debug vbus falling faster than TRIP_SLOPE
+};
+
+/// Interrupt-side state
+struct trip_state {
+    uint16_t last_dbg;
+    uint8_t blank;      ///< Samples left before the slope check applies
+};
+
+
+/// Check one filtered debug vbus sample. Return why charging must be cut, or
+/// TRIP_NONE. Call for every sample, so the slope and blanking stay current.
+static inline enum trip_reason trip_check(struct trip_state *t, uint16_t dbg, bool charging)
+{
+    enum trip_reason reason = TRIP_NONE;
+
+    if (!charging) {
+        t->blank = TRIP_BLANK;
+    } else if (dbg < TRIP_FLOOR) {
+        reason = TRIP_FLOOR_HIT;
+    } else if (t->blank) {
+        --t->blank;
+    } else if (t->last_dbg > dbg && (uint16_t)(t->last_dbg - dbg) > TRIP_SLOPE) {
+        reason = TRIP_SLOPE_HIT;
+    }
+
+    t->last_dbg = dbg;
+    return reason;
+}
+
+
+/// Check one raw debug vbus conversion against the floor only.
+static inline enum trip_reason trip_check_conversion(uint16_t dbg, bool charging)
+{
+    return (charging && dbg < TRIP_FLOOR_CONV) ? TRIP_FLOOR_HIT : TRIP_NONE;
+}
+
+
+/// Trip counters, saturating at 255
+struct trip_counters {
+    uint8_t floor;
+    uint8_t slope;
+    uint8_t retries;
+};
+
+/// Handle a latched trip: count it and schedule the retry. Call from the main
+/// loop whenever the charge fault changes; does nothing if none is latched.
+void trip_poll(void);
+
+/// Return the trip counters since startup.
+const struct trip_counters *get_trip_counters(void);
+
+#endif // _TRIP_H
@@ -0,0 +1,113 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+/// @file twi_target.h
+/// Register file protocol of the TWI target. Shared by the TWI interrupt and
+/// the host simulation's bus, so both answer a transaction alike.
+///
+/// The first byte of a write transaction sets the register pointer. Further
+/// bytes are stored from there on, the pointer advancing with each; bytes for
+/// registers below the writable boundary or past the end are acknowledged and
+/// dropped. A read returns bytes from the pointer on, advancing it likewise,
+/// and 0xff past the end. The usual register read is a one-byte write of the
+/// pointer, then a repeated start and a read.
+///
+/// The target is busy from its address to the end of the transaction. While it
+/// is busy the register file must not change, so a read of several bytes is
+/// always of one consistent set of values. Between the pointer write and the
+/// read, a repeated start makes it briefly idle.
+
+#ifndef _TWI_TARGET_H
+#define _TWI_TARGET_H 1
+
+#include <util/twi.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+enum twi_target_state {
+    TWI_TARGET_IDLE,
+    TWI_TARGET_POINTER,     ///< Addressed for writing, the next byte is the pointer
+    TWI_TARGET_WRITE,       ///< Storing bytes from the pointer on
+    TWI_TARGET_READ,        ///< Sending bytes from the pointer on
+};
+
+struct twi_target {
+    volatile uint8_t *regs; ///< Register file
+    uint8_t size;           ///< Number of registers
+    uint8_t writable;       ///< First writable register; all from there on are
+    uint8_t ptr;            ///< Register pointer
+    uint8_t state;          ///< enum twi_target_state
+};
+
+
+/// Return whether a transaction is under way.
+static inline bool twi_target_busy(const struct twi_target *t)
+{
+    return t->state != TWI_TARGET_IDLE;
+}
+
+
+/// Handle one TWI event.
+/// @param status - TWSR, masked with TW_STATUS_MASK
+/// @param data - the byte received, for receive events; receives the byte to
+///               send, for transmit events, and is left alone otherwise
+/// @return whether a byte to send was stored in data
+static inline bool twi_target_event(struct twi_target *t, uint8_t status, uint8_t *data)
+{
+    switch (status) {
+    case TW_SR_SLA_ACK:
+        t->state = TWI_TARGET_POINTER;
+        return false;
+
+    case TW_SR_DATA_ACK:
+        if (t->state == TWI_TARGET_POINTER) {
+            t->ptr = *data;
+            t->state = TWI_TARGET_WRITE;
+        } else if (t->ptr < t->size) {
+            if (t->ptr >= t->writable)
+                t->regs[t->ptr] = *data;
+            ++t->ptr;
+        }
+        return false;
+
+    case TW_ST_SLA_ACK:
+        t->state = TWI_TARGET_READ;
+        // fall through
+    case TW_ST_DATA_ACK:
+        if (t->ptr < t->size) {
+            *data = t->regs[t->ptr];
+            ++t->ptr;
+        } else {
+            *data = 0xff;
+        }
+        return true;
+
+    default:
+        // Stop or repeated start, the controller done reading, a bus error,
+        // or anything unexpected: wait to be addressed again.
+        t->state = TWI_TARGET_IDLE;
+        return false;
+    }
+}
+
+#endif // _TWI_TARGET_H
@@ -21,88 +21,270 @@
 // WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include "vbus.h"
+#include "vbus_classify.h"
 #include "hardware.h"
+#include "trace.h"
+#include "vcc.h"
+#include "config.h"
+#include "stats.h"
+#include "telemetry.h"
 
 #include <stdbool.h>
-#include <util/atomic.h>
 
-static volatile enum vbus_mode current_vbus_mode = VBUS_WAIT;
+#ifdef VBUS_LUT
+#include "vbus_lut.h"
+#endif
 
-// Read the ADC samples and give an equivalent vbus mode from them.
+// Debounce while the boot mode is provisional, in ms. Short: this only has to
+// catch a first sample taken while a rail was still coming up.
+#define DEBOUNCE_BOOT_MS    2u
+#define DEBOUNCE_BOOT       ADC_MS_TO_SAMPLES(DEBOUNCE_BOOT_MS)
+
+// How long the mode must hold, with no change under way, before the ADC drops
+// to the low-rate scan. A change seen during the scan brings the full rate
+// back at once; only its first sample is a scan frame, so the debounce runs at
+// most one scan frame long.
+#define SCAN_AFTER_MS       5000ul
+#define SCAN_AFTER          ADC_MS_TO_SAMPLES(SCAN_AFTER_MS)
+
+// Detection state of one bridge channel. All of it zero at startup: VBUS_WAIT,
+// classifier state 0 and ADC_PLAN_BALANCED are all zero.
+struct vbus_channel {
+    uint8_t current_mode;           ///< enum vbus_mode
+    uint8_t last_mode;              ///< Undebounced mode of the last sample
+    uint8_t applied_plan;           ///< enum adc_plan
+    uint16_t stable_samples;
+    uint8_t debounce_count;
+    uint8_t state;                  ///< Classifier hysteresis state
+    uint8_t forced_mode;
+    bool changed;
+    bool provisional;
+    bool scanning;
+};
+
+static struct vbus_channel channels[BRIDGE_COUNT];
+
+#define CHANNEL(ch) (&channels[BRIDGE_CH(ch)])
+
+// Read the ADC samples and give an equivalent vbus mode from them. Keeps the
+// hysteresis state between calls, so it must see every sample pair in order.
 // The result must be debounced afterward to use it meaningfully.
-static enum vbus_mode get_vbus_mode(uint16_t vbus_pixc, uint16_t vbus_dbg);
+static enum vbus_mode get_vbus_mode(uint8_t ch, uint16_t vbus_pixc, uint16_t vbus_dbg);
 
-static enum vbus_mode get_vbus_mode(uint16_t vbus_pixc, uint16_t vbus_dbg)
+// Return how many consecutive samples are needed to go from one mode to another.
+static uint8_t debounce_length(const struct vbus_channel *c, enum vbus_mode from, enum vbus_mode to);
+
+// Classify and debounce one filtered sample pair.
+static void process_sample(uint8_t ch, uint16_t pixc, uint16_t dbg);
+
+// Pick the ADC sampling plan for the current mode and how settled it is.
+static void update_adc_plan(uint8_t ch);
+
+static enum vbus_mode get_vbus_mode(uint8_t ch, uint16_t vbus_pixc, uint16_t vbus_dbg)
 {
-    bool pixc_valid = (vbus_pixc >= ADC_VAL(4.0));
-    bool dbg_valid  = (vbus_dbg  >= ADC_VAL(4.0));
-
-    static const uint16_t adc_diode_min = ADC_VAL(0.25);
-    static const uint16_t adc_diode_max = ADC_VAL(0.85);
-
-    bool diode = (vbus_dbg > (vbus_pixc - adc_diode_max)) &&
-                 (vbus_dbg < (vbus_pixc - adc_diode_min)) &&
-                 !is_charge_enabled();
-
-    //  PIXC    DBG     DIODE   OUT
-    //  0       0       0       VBUS_NONE
-    //  0       0       1       VBUS_NONE (!)
-    //  0       1       0       VBUS_DEBUG_ONLY
-    //  0       1       1       VBUS_DEBUG_ONLY (!)
-    //  1       0       0       VBUS_PIXC_ONLY
-    //  1       0       1       VBUS_BOTH_DIODE
-    //  1       1       0       VBUS_BOTH
-    //  1       1       1       VBUS_BOTH_DIODE
-    //
-    //  (PIXC & !DBG & DIODE) could mean pixc's vbus was marginal, such that pixc
-    //  vbus was valid but vbus-diode was not. This is still the diode case.
-
-    if (!pixc_valid && !dbg_valid) {
-        return VBUS_NONE;
-    } else if (!pixc_valid && dbg_valid) {
-        return VBUS_DEBUG_ONLY;
-    } else if (pixc_valid && !dbg_valid && !diode) {
-        return VBUS_PIXC_ONLY;
-    } else if (pixc_valid && dbg_valid && !diode) {
-        return VBUS_BOTH;
-    } else if (pixc_valid && diode) {
-        return VBUS_BOTH_DIODE;
-    } else {
-        // should not happen, all cases should be covered above.
-        return VBUS_NONE;
+    struct vbus_channel *c = CHANNEL(ch);
+
+#ifdef VBUS_LUT
+    c->state = vbus_classify_lut(vbus_level_lut, c->state, vbus_pixc, vbus_dbg, is_charge_enabled(ch));
+#else
+    c->state = vbus_classify(&config.thresholds, c->state, vbus_pixc, vbus_dbg, is_charge_enabled(ch));
+#endif
+
+    return vbus_state_mode(c->state);
+}
+
+
+// Number of rails actually supplying power in a mode.
+static uint8_t powered_rails(enum vbus_mode mode)
+{
+    switch (mode) {
+    case VBUS_BOTH:
+        return 2;
+    case VBUS_PIXC_ONLY:
+    case VBUS_DEBUG_ONLY:
+    case VBUS_BOTH_DIODE:
+        return 1;
+    default:
+        return 0;
     }
 }
 
 
-void vbus_adc_callback(uint16_t pixc, uint16_t dbg)
+static uint8_t debounce_length(const struct vbus_channel *c, enum vbus_mode from, enum vbus_mode to)
 {
-    static enum vbus_mode last_mode = VBUS_NONE;
-    static const uint16_t debounce_top = 20u;
-    static uint16_t debounce_count = 0u;
+    if (c->provisional)
+        return DEBOUNCE_BOOT;
+
+    return (powered_rails(to) > powered_rails(from)) ? config.debounce_attach : config.debounce_detach;
+}
+
+
+// Record a debounced mode. The stats, trace and marker follow channel 0.
+// Confirming the provisional boot mode is not a transition, and the trace
+// leaves out the boot mode too.
+static void commit_mode(uint8_t ch, struct vbus_channel *c, enum vbus_mode mode)
+{
+    if (ch == 0) {
+        MARK_EVENT(MARK_COMMIT);
+        if (c->current_mode != mode) {
+            stats_transition(c->current_mode, mode);
+            if (c->current_mode != VBUS_WAIT)
+                trace_trigger();
+        }
+    }
+    c->current_mode = mode;
+    c->changed = true;
+}
+
+
+static void process_sample(uint8_t ch, uint16_t pixc, uint16_t dbg)
+{
+    struct vbus_channel *c = CHANNEL(ch);
 
     // Get the vbus mode from the samples, then debounce it.
-    enum vbus_mode mode = get_vbus_mode(pixc, dbg);
+    enum vbus_mode mode = get_vbus_mode(ch, pixc, dbg);
+
+    if (mode != c->last_mode) {
+        if (c->debounce_count && ch == 0)
+            stats_debounce_reset();
+        c->debounce_count = 0;
+        c->last_mode = mode;
+        if (ch == 0 && mode != c->current_mode && c->current_mode != VBUS_WAIT)
+            trace_arm();
+    }
 
-    if (mode == last_mode) {
-        ++debounce_count;
-        if (debounce_count == debounce_top) {
-            debounce_count = 0;
-            current_vbus_mode = mode;
+    if (c->current_mode == VBUS_WAIT) {
+        // Boot: take the first sample's mode straight away, provisionally
+        commit_mode(ch, c, mode);
+        c->provisional = true;
+    } else if (mode != c->current_mode || c->provisional) {
+        // A provisional mode is debounced like a change, against itself: once
+        // any mode has been seen for DEBOUNCE_BOOT samples, it is confirmed.
+        ++c->debounce_count;
+        if (c->debounce_count >= debounce_length(c, c->current_mode, mode)) {
+            c->debounce_count = 0;
+            commit_mode(ch, c, mode);
+            c->provisional = false;
         }
-    } else {
-        debounce_count = 0;
-        last_mode = mode;
+    }
+
+    if (mode != c->current_mode || c->provisional)
+        c->stable_samples = 0;
+    else if (c->stable_samples < SCAN_AFTER)
+        ++c->stable_samples;
+
+    if (ch == 0)
+        trace_sample(((uint16_t) mode << TRACE_MODE_SHIFT) | pixc,
+                     ((uint16_t) c->current_mode << TRACE_MODE_SHIFT) | dbg);
+}
+
+
+// Sampling plan for a mode: the rail whose loss ends the mode is critical.
+static enum adc_plan mode_plan(enum vbus_mode mode)
+{
+    switch (mode) {
+    case VBUS_DEBUG_ONLY:
+    case VBUS_BOTH:
+        return ADC_PLAN_DBG;
+    case VBUS_PIXC_ONLY:
+        return ADC_PLAN_PIXC;
+    default:
+        return ADC_PLAN_BALANCED;
     }
 }
 
 
-enum vbus_mode get_current_vbus_mode()
+static void update_adc_plan(uint8_t ch)
 {
-    enum vbus_mode mode;
+    struct vbus_channel *c = CHANNEL(ch);
+    enum adc_plan plan = mode_plan(c->current_mode);
+
+    // Charging stays at the full rate: the trip slope is per sample.
+    bool scan = c->stable_samples >= SCAN_AFTER && plan != ADC_PLAN_DBG;
 
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        mode = current_vbus_mode;
+    if (plan != c->applied_plan || scan != c->scanning) {
+        c->applied_plan = plan;
+        c->scanning = scan;
+        set_adc_plan(ch, plan, scan);
     }
+}
+
+
+bool vbus_poll(void)
+{
+    uint16_t pixc, dbg, bandgap;
+    uint8_t ch;
+    bool changed = false;
+
+    if (get_adc_bandgap(&bandgap)) {
+        vcc_update(bandgap);
+    }
+
+    // Samples are processed in order, so the hysteresis and debounce state see
+    // every pair even if several queued up while the main loop was busy.
+    stats_sample_wait();
+    while (get_adc_sample(&ch, &pixc, &dbg)) {
+        uint16_t pixc_corrected = vcc_correct(pixc);
+        uint16_t dbg_corrected = vcc_correct(dbg);
+
+        process_sample(ch, pixc_corrected, dbg_corrected);
+        if (ch == 0)
+            telemetry_sample(pixc, dbg, pixc_corrected, dbg_corrected);
+    }
+    stats_dwell(channels[0].current_mode);
+
+    for (ch = 0; ch < BRIDGE_COUNT; ++ch) {
+        update_adc_plan(ch);
+        changed |= channels[ch].changed;
+    }
+
+    return changed;
+}
+
+
+enum vbus_mode get_current_vbus_mode(uint8_t ch)
+{
+    return CHANNEL(ch)->current_mode;
+}
+
+
+bool is_vbus_mode_provisional(uint8_t ch)
+{
+    return CHANNEL(ch)->provisional;
+}
+
+
+bool is_vbus_mode_settled(void)
+{
+    for (uint8_t ch = 0; ch < BRIDGE_COUNT; ++ch) {
+        if (!channels[ch].scanning)
+            return false;
+    }
+    return true;
+}
+
+
+void vbus_force_mode(uint8_t ch, uint8_t mode)
+{
+    struct vbus_channel *c = CHANNEL(ch);
+
+    c->forced_mode = (mode < VBUS_MODE_COUNT) ? mode : VBUS_WAIT;
+    c->changed = true;
+}
+
+
+bool is_vbus_mode_forced(uint8_t ch)
+{
+    return CHANNEL(ch)->forced_mode != VBUS_WAIT;
+}
+
+
+bool get_vbus_mode_change(uint8_t ch, enum vbus_mode *mode)
+{
+    struct vbus_channel *c = CHANNEL(ch);
+    bool changed = c->changed;
 
-    return mode;
+    c->changed = false;
+    *mode = is_vbus_mode_forced(ch) ? c->forced_mode : c->current_mode;
+    return changed;
 }
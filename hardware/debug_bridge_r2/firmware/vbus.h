@@ -27,6 +27,7 @@
 #define _VBUS_H 1
 
 #include <inttypes.h>
+#include <stdbool.h>
 
 /// Vbus modes represent various possible states of the vbus lines
 enum vbus_mode {
@@ -40,11 +41,42 @@ enum vbus_mode {
                         //  body diode, and is not actually powered.
 };
 
+#define VBUS_MODE_COUNT (VBUS_BOTH_DIODE + 1)
 
-/// ADC callback to process samples. This must be registered with adc_init.
-void vbus_adc_callback(uint16_t vbus_pixc, uint16_t vbus_dbg);
 
-/// Return the current debounced vbus mode.
-enum vbus_mode get_current_vbus_mode();
+/// Classify and debounce all queued ADC samples, of every bridge channel.
+/// Call from the main loop. Each channel keeps its own mode; the stats, trace
+/// and telemetry follow channel 0.
+/// @return whether any channel's debounced mode changed, see
+///     get_vbus_mode_change()
+bool vbus_poll(void);
+
+/// Return the current debounced vbus mode of a channel.
+enum vbus_mode get_current_vbus_mode(uint8_t ch);
+
+/// Return whether a channel's current mode is provisional. At boot, the first
+/// sample pair sets the mode at once; it is confirmed, or replaced, after a
+/// short debounce, which raises another mode change event even if the mode is
+/// the same.
+bool is_vbus_mode_provisional(uint8_t ch);
+
+/// Return whether the mode of every channel has held long enough, with no
+/// change under way, for the ADC to be in the low-rate scan.
+bool is_vbus_mode_settled(void);
+
+/// Override a channel's debounced mode, as if it had been detected. Anything
+/// that is not a mode, or VBUS_WAIT, ends the override. Raises a mode change
+/// event either way.
+void vbus_force_mode(uint8_t ch, uint8_t mode);
+
+/// Return whether a channel's mode is overridden by vbus_force_mode().
+bool is_vbus_mode_forced(uint8_t ch);
+
+/// Consume a channel's "mode changed" event, raised when its debounced mode
+/// changes.
+/// @param ch - bridge channel
+/// @param mode - receives the current debounced vbus mode, or the forced one
+/// @return whether the mode changed since the last call
+bool get_vbus_mode_change(uint8_t ch, enum vbus_mode *mode);
 
 #endif // _VBUS_H
@@ -0,0 +1,219 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+/// @file vbus_classify.h
+/// Vbus sample classification, shared by the firmware and the host build tools.
+///
+/// The classifier turns one pair of filtered samples into a new state: whether
+/// each rail is valid and whether the debug rail is a body diode drop below
+/// pixc. Each of those has hysteresis, so the next state depends on the last.
+///
+/// vbus_classify() is the reference, working on ADC_BITS-wide values. Building
+/// with VBUS_LUT selects an 8-bit fast path instead (ADC_BITS = 8, read from
+/// ADCH): vbus_classify_lut() does three lookups in a 256-byte PROGMEM table
+/// generated from the default thresholds below by sim/gen_vbus_lut, which
+/// refuses to emit a table that disagrees with vbus_classify() for any input.
+
+#ifndef _VBUS_CLASSIFY_H
+#define _VBUS_CLASSIFY_H 1
+
+#include "hardware.h"
+#include "vbus.h"
+
+#include <stdbool.h>
+#include <inttypes.h>
+
+// Default thresholds, in volts. They can be overridden at runtime from the
+// EEPROM configuration (config.h), except in the VBUS_LUT build, which bakes
+// them into its table.
+
+// Rail valid thresholds. A rail becomes valid at or above RISE and stays valid
+// until it drops below FALL, so a rail sitting near one threshold cannot
+// toggle on every sample.
+#define VBUS_VALID_RISE_V   4.1
+#define VBUS_VALID_FALL_V   3.9
+
+// Body diode window on the drop from pixc to dbg. The diode case is entered
+// when the drop is inside the ENTER window and left when it is outside LEAVE.
+#define DIODE_ENTER_MIN_V   0.30
+#define DIODE_ENTER_MAX_V   0.80
+#define DIODE_LEAVE_MIN_V   0.20
+#define DIODE_LEAVE_MAX_V   0.90
+
+#define VBUS_VALID_RISE     ADC_VAL(VBUS_VALID_RISE_V)
+#define VBUS_VALID_FALL     ADC_VAL(VBUS_VALID_FALL_V)
+#define DIODE_ENTER_MIN     ADC_VAL(DIODE_ENTER_MIN_V)
+#define DIODE_ENTER_MAX     ADC_VAL(DIODE_ENTER_MAX_V)
+#define DIODE_LEAVE_MIN     ADC_VAL(DIODE_LEAVE_MIN_V)
+#define DIODE_LEAVE_MAX     ADC_VAL(DIODE_LEAVE_MAX_V)
+
+/// Classifier thresholds, in ADC_BITS-wide sample units
+struct vbus_thresholds {
+    uint16_t valid_rise;
+    uint16_t valid_fall;
+    uint16_t diode_enter_min;
+    uint16_t diode_enter_max;
+    uint16_t diode_leave_min;
+    uint16_t diode_leave_max;
+};
+
+#define VBUS_THRESHOLDS_DEFAULT { \
+    .valid_rise         = VBUS_VALID_RISE, \
+    .valid_fall         = VBUS_VALID_FALL, \
+    .diode_enter_min    = DIODE_ENTER_MIN, \
+    .diode_enter_max    = DIODE_ENTER_MAX, \
+    .diode_leave_min    = DIODE_LEAVE_MIN, \
+    .diode_leave_max    = DIODE_LEAVE_MAX, \
+}
+
+/// Classifier state bits
+#define VBUS_ST_PIXC        0x01u   ///< PixC vbus valid
+#define VBUS_ST_DBG         0x02u   ///< Debug port vbus valid
+#define VBUS_ST_DIODE       0x04u   ///< Debug vbus is a body diode drop below PixC
+
+/// Level table bits, per 8-bit value
+#define VBUS_LVL_RISE       0x01u   ///< value >= VBUS_VALID_RISE
+#define VBUS_LVL_FALL       0x02u   ///< value >= VBUS_VALID_FALL
+#define VBUS_LVL_ENTER      0x04u   ///< value inside the diode ENTER window
+#define VBUS_LVL_LEAVE      0x08u   ///< value inside the diode LEAVE window
+
+
+/// Reference classifier. Return the next state from the last one and a sample pair.
+static inline uint8_t vbus_classify(const struct vbus_thresholds *th, uint8_t state,
+                                    uint16_t pixc, uint16_t dbg, bool charging)
+{
+    uint8_t next = 0;
+
+    if (pixc >= ((state & VBUS_ST_PIXC) ? th->valid_fall : th->valid_rise))
+        next |= VBUS_ST_PIXC;
+    if (dbg >= ((state & VBUS_ST_DBG) ? th->valid_fall : th->valid_rise))
+        next |= VBUS_ST_DBG;
+
+    // Only compute the drop when it is positive; with charging on, the debug
+    // rail is fed through the switch and cannot be a diode drop.
+    if (!charging && dbg < pixc) {
+        uint16_t drop = pixc - dbg;
+
+        if (state & VBUS_ST_DIODE) {
+            if (drop >= th->diode_leave_min && drop <= th->diode_leave_max)
+                next |= VBUS_ST_DIODE;
+        } else {
+            if (drop >= th->diode_enter_min && drop <= th->diode_enter_max)
+                next |= VBUS_ST_DIODE;
+        }
+    }
+
+    return next;
+}
+
+
+/// Return the vbus mode for a classifier state.
+static inline enum vbus_mode vbus_state_mode(uint8_t state)
+{
+    bool pixc_valid = state & VBUS_ST_PIXC;
+    bool dbg_valid  = state & VBUS_ST_DBG;
+    bool diode      = state & VBUS_ST_DIODE;
+
+    //  PIXC    DBG     DIODE   OUT
+    //  0       0       0       VBUS_NONE
+    //  0       0       1       VBUS_NONE (!)
+    //  0       1       0       VBUS_DEBUG_ONLY
+    //  0       1       1       VBUS_DEBUG_ONLY (!)
+    //  1       0       0       VBUS_PIXC_ONLY
+    //  1       0       1       VBUS_BOTH_DIODE
+    //  1       1       0       VBUS_BOTH
+    //  1       1       1       VBUS_BOTH_DIODE
+    //
+    //  (PIXC & !DBG & DIODE) could mean pixc's vbus was marginal, such that pixc
+    //  vbus was valid but vbus-diode was not. This is still the diode case.
+
+    if (!pixc_valid && !dbg_valid) {
+        return VBUS_NONE;
+    } else if (!pixc_valid && dbg_valid) {
+        return VBUS_DEBUG_ONLY;
+    } else if (pixc_valid && !dbg_valid && !diode) {
+        return VBUS_PIXC_ONLY;
+    } else if (pixc_valid && dbg_valid && !diode) {
+        return VBUS_BOTH;
+    } else if (pixc_valid && diode) {
+        return VBUS_BOTH_DIODE;
+    } else {
+        // should not happen, all cases should be covered above.
+        return VBUS_NONE;
+    }
+}
+
+
+#ifdef VBUS_LUT
+
+#if ADC_BITS != 8
+#error "VBUS_LUT needs ADC_BITS = 8"
+#endif
+
+#ifndef VBUS_LUT_READ
+#include <avr/pgmspace.h>
+#define VBUS_LUT_READ(addr) pgm_read_byte(addr)
+#endif
+
+/// Return the level table entry for an 8-bit value. Used to generate the table.
+static inline uint8_t vbus_level(uint8_t val)
+{
+    uint8_t lvl = 0;
+
+    if (val >= VBUS_VALID_RISE)
+        lvl |= VBUS_LVL_RISE;
+    if (val >= VBUS_VALID_FALL)
+        lvl |= VBUS_LVL_FALL;
+    if (val >= DIODE_ENTER_MIN && val <= DIODE_ENTER_MAX)
+        lvl |= VBUS_LVL_ENTER;
+    if (val >= DIODE_LEAVE_MIN && val <= DIODE_LEAVE_MAX)
+        lvl |= VBUS_LVL_LEAVE;
+
+    return lvl;
+}
+
+
+/// Table-driven classifier on 8-bit values; same result as vbus_classify().
+/// A valid rail stays valid on its FALL bit, an invalid one needs RISE; the
+/// diode likewise stays on LEAVE and needs ENTER. A zero drop is in neither
+/// window, which covers dbg >= pixc.
+static inline uint8_t vbus_classify_lut(const uint8_t *lut, uint8_t state,
+                                        uint8_t pixc, uint8_t dbg, bool charging)
+{
+    uint8_t lvl_pixc = VBUS_LUT_READ(&lut[pixc]);
+    uint8_t lvl_dbg  = VBUS_LUT_READ(&lut[dbg]);
+    uint8_t lvl_drop = VBUS_LUT_READ(&lut[(pixc > dbg) ? (uint8_t)(pixc - dbg) : 0]);
+    uint8_t next = 0;
+
+    if (lvl_pixc & ((state & VBUS_ST_PIXC) ? VBUS_LVL_FALL : VBUS_LVL_RISE))
+        next |= VBUS_ST_PIXC;
+    if (lvl_dbg & ((state & VBUS_ST_DBG) ? VBUS_LVL_FALL : VBUS_LVL_RISE))
+        next |= VBUS_ST_DBG;
+    if (!charging && (lvl_drop & ((state & VBUS_ST_DIODE) ? VBUS_LVL_LEAVE : VBUS_LVL_ENTER)))
+        next |= VBUS_ST_DIODE;
+
+    return next;
+}
+
+#endif // VBUS_LUT
+
+#endif // _VBUS_CLASSIFY_H
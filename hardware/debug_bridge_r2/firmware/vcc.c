@@ -0,0 +1,81 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "vcc.h"
+
+#if ADC_BANDGAP_PERIOD
+
+#define SCALE_SHIFT     14
+#define SCALE_ONE       (1u << SCALE_SHIFT)
+
+// Smoothing: the filter holds FILTER_N times the average reading
+#define FILTER_SHIFT    3
+#define FILTER_N        (1u << FILTER_SHIFT)
+
+// Bandgap readings for the plausible supply range; a low supply reads high
+#define BANDGAP_MIN     ((uint16_t)(ADC_BANDGAP_NOMINAL * ADC_VCC_NOMINAL / VCC_MAX))
+#define BANDGAP_MAX     ((uint16_t)(ADC_BANDGAP_NOMINAL * ADC_VCC_NOMINAL / VCC_MIN))
+
+// Numerators for the scale factor and the supply, against the filter sum
+#define SCALE_NUM       ((uint32_t)(ADC_BANDGAP_NOMINAL * FILTER_N * SCALE_ONE))
+#define MV_NUM          ((uint32_t)(ADC_BANDGAP_NOMINAL * FILTER_N * ADC_VCC_NOMINAL * 1000))
+
+#define SAMPLE_MAX      ((1u << ADC_BITS) - 1u)
+
+_Static_assert(SCALE_NUM / ((uint32_t) BANDGAP_MIN * FILTER_N) <= 0xffffu,
+               "scale factor overflows 16 bits");
+
+static uint16_t filter = 0;             ///< FILTER_N * average bandgap, 0 if none yet
+static uint16_t scale = SCALE_ONE;
+
+
+void vcc_update(uint16_t bandgap)
+{
+    if (bandgap < BANDGAP_MIN || bandgap > BANDGAP_MAX)
+        return;
+
+    if (filter == 0)
+        filter = bandgap << FILTER_SHIFT;
+    else
+        filter = filter - (filter >> FILTER_SHIFT) + bandgap;
+
+    scale = SCALE_NUM / filter;
+}
+
+
+uint16_t vcc_correct(uint16_t sample)
+{
+    uint32_t corrected = ((uint32_t) sample * scale) >> SCALE_SHIFT;
+
+    return (corrected > SAMPLE_MAX) ? SAMPLE_MAX : corrected;
+}
+
+
+uint16_t vcc_get_mv(void)
+{
+    if (filter == 0)
+        return (uint16_t)(ADC_VCC_NOMINAL * 1000);
+
+    return MV_NUM / filter;
+}
+
+#endif // ADC_BANDGAP_PERIOD
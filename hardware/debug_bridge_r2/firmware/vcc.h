@@ -0,0 +1,73 @@
+// Copyright (c) 2016 Assured Information Security, Inc.
+// Author: Chris Pavlina <pavlina.chris@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+/// @file vcc.h
+/// Supply voltage correction.
+///
+/// The ADC uses AVcc as its reference, so a sample is proportional to vbus
+/// divided by the supply, and the fixed thresholds from ADC_VAL() are only
+/// right at ADC_VCC_NOMINAL. The bandgap conversion measures the supply the
+/// same way: at supply Vcc it reads ADC_BANDGAP_NOMINAL * ADC_VCC_NOMINAL / Vcc.
+/// Multiplying each sample by ADC_BANDGAP_NOMINAL / bandgap therefore turns it
+/// into what it would have read at the nominal supply.
+///
+/// The factor is a 2.14 fixed-point number, recomputed only when a new bandgap
+/// conversion arrives; correcting a sample is one multiply and shift. Bandgap
+/// readings are smoothed over about 8 conversions, and readings implying a
+/// supply outside VCC_MIN..VCC_MAX are ignored.
+///
+/// The bandgap voltage itself varies between parts, so this corrects supply
+/// drift and sag rather than absolute error.
+
+#ifndef _VCC_H
+#define _VCC_H 1
+
+#include "hardware.h"
+
+#include <stdbool.h>
+#include <inttypes.h>
+
+/// Plausible supply range; outside it, a bandgap reading is taken as bad
+#define VCC_MIN     2.5
+#define VCC_MAX     5.5
+
+#if ADC_BANDGAP_PERIOD
+
+/// Take in a new raw bandgap conversion.
+void vcc_update(uint16_t bandgap);
+
+/// Return a filtered sample corrected to the nominal supply.
+uint16_t vcc_correct(uint16_t sample);
+
+/// Return the measured supply in mV, or the nominal supply before the first
+/// measurement.
+uint16_t vcc_get_mv(void);
+
+#else
+
+#define vcc_update(bandgap)     do { } while (0)
+#define vcc_correct(sample)     (sample)
+#define vcc_get_mv()            ((uint16_t)(ADC_VCC_NOMINAL * 1000))
+
+#endif // ADC_BANDGAP_PERIOD
+
+#endif // _VCC_H